@@ -18,8 +18,17 @@
 #include <optional>
 #include <set>
 #include <fstream>
+#include <random>
 
 #include "window.h"
+#include "diagnostics.h"
+#include "mesh.h"
+#include "lighting.h"
+#include "culling.h"
+#include "capture.h"
+#include "resolution.h"
+
+#include <glm/gtc/matrix_transform.hpp>
 
 #define WINDOW window.window
 
@@ -33,6 +42,74 @@ struct QueueFamilyIndices {
 	}
 };
 
+enum class RunMode {
+	Interactive,
+	Replay
+};
+
+enum class SceneType {
+	Field, // Sphere field seen from above, little occlusion
+	City // Dense blocks seen from street level, most of the scene is hidden
+};
+
+// What the next frame depends on that changed since the last one, see main_loop
+enum DirtyFlags : uint32_t {
+	DIRTY_NONE = 0,
+	DIRTY_SCENE = 1 << 0, // Render setting toggles, scene edits
+	DIRTY_ANIMATION = 1 << 1, // Scene time advanced: lights, and the camera in the City scene
+	DIRTY_WINDOW = 1 << 2, // Window exposed or restored, the last image only has to be presented again
+	DIRTY_RENDER = DIRTY_SCENE | DIRTY_ANIMATION // Anything here re-renders the scene
+};
+
+// Command line options, see main.cpp
+struct RunConfig {
+	RunMode mode = RunMode::Interactive;
+	std::string capture_path; // Interactive: write the first capture_frames frames here
+	uint32_t capture_frames = 1;
+	std::string replay_path;
+	uint32_t replay_iterations = 100;
+	SceneType scene = SceneType::Field; // Interactive only, replays draw what was captured
+	ResolutionSettings resolution; // Replays render at max_scale, so their timings stay comparable
+	bool on_demand = false; // Interactive: only render when something changed, starts with animation paused
+};
+
+struct AllocatedBuffer {
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	void* mapped = nullptr; // Host visible buffers stay mapped
+};
+
+// Clustered vs brute force totals for the exit report
+struct LightingStats {
+	uint64_t frames = 0;
+	uint64_t fragments = 0;
+	uint64_t lights_evaluated = 0;
+	uint64_t overflow_frames = 0;
+	uint64_t light_count = 0;
+};
+
+// Culling on totals for the exit report
+struct CullingStats {
+	uint64_t frames = 0;
+	uint64_t draws = 0;
+	uint64_t drawn_early = 0;
+	uint64_t drawn_late = 0;
+	uint64_t frustum_culled = 0;
+	uint64_t occlusion_culled = 0;
+};
+
+// Per mode (LOD on/off x optimized on/off) totals for the exit report.
+// triangles and estimated_vertex_invocations are what the CPU submitted, before GPU culling;
+// the measured_ fields come from the pipeline statistics query and are what was actually rendered.
+struct MeshStats {
+	uint64_t frames = 0;
+	uint64_t triangles = 0;
+	uint64_t estimated_vertex_invocations = 0;
+	uint64_t measured_frames = 0;
+	uint64_t measured_primitives = 0;
+	uint64_t measured_vertex_invocations = 0;
+};
+
 struct SwapChainSupportDetails {
 	VkSurfaceCapabilitiesKHR capabilities;
 	std::vector<VkSurfaceFormatKHR> formats;
@@ -60,36 +137,141 @@ class Application {
 public:
 	static constexpr int WIDTH = 800;
 	static constexpr int HEIGHT = 600;
-	Application(void) {}
+	static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+	static constexpr uint32_t LIGHT_COUNT = 4096;
+	static constexpr uint32_t LIGHT_SEED = 1337;
+	static constexpr float NEAR_PLANE = 0.1f;
+	static constexpr float FAR_PLANE = 200.0f;
+	static constexpr int CITY_BLOCKS = 40;
+	static constexpr float CITY_SPACING = 4.0f;
+	Application(RunConfig run_config = RunConfig{}) : config(run_config), window{ WIDTH, HEIGHT, "Vulkan", run_config.mode == RunMode::Replay } {}
 	~Application(void)
 	{
+		for (size_t i = 0; i < in_flight_fences.size(); i++) {
+			vkDestroySemaphore(device, render_finished_semaphores[i], nullptr);
+			vkDestroySemaphore(device, image_available_semaphores[i], nullptr);
+			vkDestroyFence(device, in_flight_fences[i], nullptr);
+		}
+		if (statistics_query_pool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, statistics_query_pool, nullptr);
+		}
+		if (timestamp_query_pool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timestamp_query_pool, nullptr);
+		}
+		vkDestroyCommandPool(device, command_pool, nullptr);
+		for (size_t i = 0; i < uniform_buffers.size(); i++) {
+			destroy_buffer(uniform_buffers[i]);
+			destroy_buffer(light_buffers[i]);
+			destroy_buffer(cluster_grid_buffers[i]);
+			destroy_buffer(light_index_buffers[i]);
+			destroy_buffer(cluster_stats_buffers[i]);
+			destroy_buffer(draw_buffers[i]);
+			destroy_buffer(indirect_buffers[i]);
+			destroy_buffer(cull_stats_buffers[i]);
+		}
+		destroy_buffer(visibility_buffer);
+		vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+		vkDestroySampler(device, scene_sampler, nullptr);
+		vkDestroySampler(device, depth_sampler, nullptr);
+		for (auto level_view : depth_pyramid_level_views) {
+			vkDestroyImageView(device, level_view, nullptr);
+		}
+		vkDestroyImageView(device, depth_pyramid_view, nullptr);
+		vkDestroyImage(device, depth_pyramid, nullptr);
+		vkFreeMemory(device, depth_pyramid_memory, nullptr);
+		vkDestroyBuffer(device, index_buffer, nullptr);
+		vkFreeMemory(device, index_buffer_memory, nullptr);
+		vkDestroyBuffer(device, vertex_buffer, nullptr);
+		vkFreeMemory(device, vertex_buffer_memory, nullptr);
+		if (replay_image != VK_NULL_HANDLE) {
+			vkDestroyFramebuffer(device, replay_framebuffer, nullptr);
+			vkDestroyImageView(device, replay_image_view, nullptr);
+			vkDestroyImage(device, replay_image, nullptr);
+			vkFreeMemory(device, replay_image_memory, nullptr);
+		}
+		for (auto framebuffer : swap_chain_framebuffers) {
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		}
+		vkDestroyFramebuffer(device, scene_framebuffer, nullptr);
+		vkDestroyImageView(device, scene_color_view, nullptr);
+		vkDestroyImage(device, scene_color_image, nullptr);
+		vkFreeMemory(device, scene_color_memory, nullptr);
+		vkDestroyImageView(device, depth_image_view, nullptr);
+		vkDestroyImage(device, depth_image, nullptr);
+		vkFreeMemory(device, depth_image_memory, nullptr);
+		vkDestroyPipeline(device, depth_reduce_pipeline, nullptr);
+		vkDestroyPipelineLayout(device, depth_reduce_pipeline_layout, nullptr);
+		vkDestroyPipeline(device, cull_pipeline, nullptr);
+		vkDestroyPipelineLayout(device, cull_pipeline_layout, nullptr);
+		vkDestroyPipeline(device, cluster_pipeline, nullptr);
+		vkDestroyPipelineLayout(device, cluster_pipeline_layout, nullptr);
+		vkDestroyPipeline(device, upscale_pipeline, nullptr);
+		vkDestroyPipelineLayout(device, upscale_pipeline_layout, nullptr);
 		vkDestroyPipeline(device, graphics_pipeline, nullptr);
 		vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+		vkDestroyDescriptorSetLayout(device, upscale_set_layout, nullptr);
+		vkDestroyDescriptorSetLayout(device, depth_reduce_set_layout, nullptr);
+		vkDestroyDescriptorSetLayout(device, cull_set_layout, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptor_set_layout, nullptr);
+		vkDestroyRenderPass(device, present_render_pass, nullptr);
+		vkDestroyRenderPass(device, late_render_pass, nullptr);
 		vkDestroyRenderPass(device, render_pass, nullptr);
 		for (auto image_view : swap_chain_image_views) {
 			vkDestroyImageView(device, image_view, nullptr);
 		}
-		vkDestroySwapchainKHR(device, swap_chain, nullptr);
+		if (swap_chain != VK_NULL_HANDLE) {
+			vkDestroySwapchainKHR(device, swap_chain, nullptr);
+		}
 		vkDestroyDevice(device, nullptr);
 		if (enable_validation_layers) {
 			DestroyDebugUtilsMessengerEXT(instance, debug_messenger, nullptr);
 		}
-		vkDestroySurfaceKHR(instance, surface, nullptr);
+		if (surface != VK_NULL_HANDLE) {
+			vkDestroySurfaceKHR(instance, surface, nullptr);
+		}
 		vkDestroyInstance(instance, nullptr);
+
+		if (config.mode == RunMode::Interactive) {
+			frame_timer.report("main loop");
+			activity.report("main loop");
+			gpu_frame_timer.report("gpu");
+			binning_timer.report("light binning");
+			report_mesh_stats();
+			report_lighting_stats();
+			report_culling_stats();
+			resolution_controller.report("dynamic resolution");
+		}
 	}
 	void run()
 	{
 		init_vulkan();
-		main_loop();
+		if (config.mode == RunMode::Replay) {
+			replay();
+		}
+		else {
+			main_loop();
+		}
 	}
 private:
 	// Windowing / Instance
-	Window window{ WIDTH, HEIGHT, "Vulkan" };
+	RunConfig config;
+	Window window;
 	VkInstance instance;
 	VkDebugUtilsMessengerEXT debug_messenger;
-	VkSurfaceKHR surface;
+	VkSurfaceKHR surface = VK_NULL_HANDLE; // None when replaying
 	std::string name;
 
+	// Diagnostics
+	Diagnostics diagnostics;
+	FrameTimer frame_timer; // Iterations that rendered the scene
+	ActivityMeter activity;
+
+	// Render On Demand
+	static constexpr double IDLE_WAIT_SECONDS = 0.5;
+	uint32_t dirty = DIRTY_RENDER; // Nothing has been rendered yet
+	bool animating = true; // P to toggle
+	double scene_time = 0.0; // Drives lights and camera, stands still while animation is paused
+
 	// Physical Device
 	VkPhysicalDevice physical_device = VK_NULL_HANDLE;
 	
@@ -99,16 +281,132 @@ private:
 	VkQueue present_queue;
 
 	// Swap Chain
-	VkSwapchainKHR swap_chain;
+	VkSwapchainKHR swap_chain = VK_NULL_HANDLE;
 	std::vector<VkImage> swap_chain_images;
 	VkFormat swap_chain_image_format;
 	VkExtent2D swap_chain_extent;
 	std::vector<VkImageView> swap_chain_image_views;
 
 	// Graphics Pipeline
-	VkRenderPass render_pass;
+	VkRenderPass render_pass; // Clears, draws the early cull phase
+	VkRenderPass late_render_pass; // Loads, draws the late cull phase and leaves the scene color readable
+	VkRenderPass present_render_pass; // Upscales the scene color into the swapchain image
 	VkPipelineLayout pipeline_layout;
 	VkPipeline graphics_pipeline;
+	std::vector<VkFramebuffer> swap_chain_framebuffers; // Present pass only, the scene draws into scene_framebuffer
+	VkFormat depth_format;
+	VkImage depth_image = VK_NULL_HANDLE;
+	VkDeviceMemory depth_image_memory = VK_NULL_HANDLE;
+	VkImageView depth_image_view = VK_NULL_HANDLE;
+
+	// Commands and Sync
+	VkCommandPool command_pool;
+	std::vector<VkCommandBuffer> command_buffers;
+	std::vector<VkSemaphore> image_available_semaphores;
+	std::vector<VkSemaphore> render_finished_semaphores;
+	std::vector<VkFence> in_flight_fences;
+	std::vector<VkFence> images_in_flight;
+	size_t current_frame = 0;
+
+	// Scene
+	Mesh mesh;
+	std::vector<MeshInstance> instances;
+	VkBuffer vertex_buffer;
+	VkDeviceMemory vertex_buffer_memory;
+	VkBuffer index_buffer;
+	VkDeviceMemory index_buffer_memory;
+	bool lod_enabled = true; // L to toggle
+	bool mesh_optimized = true; // O to toggle
+	float lod_threshold_pixels = 1.0f;
+
+	// Clustered Lighting
+	VkDescriptorSetLayout descriptor_set_layout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> descriptor_sets;
+	VkPipelineLayout cluster_pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline cluster_pipeline = VK_NULL_HANDLE;
+	std::vector<AllocatedBuffer> uniform_buffers; // Per frame in flight from here down
+	std::vector<AllocatedBuffer> light_buffers;
+	std::vector<AllocatedBuffer> cluster_grid_buffers;
+	std::vector<AllocatedBuffer> light_index_buffers;
+	std::vector<AllocatedBuffer> cluster_stats_buffers;
+	bool cluster_stats_pending[MAX_FRAMES_IN_FLIGHT] = {};
+	bool cluster_stats_brute_force[MAX_FRAMES_IN_FLIGHT] = {};
+	uint32_t cluster_stats_light_count[MAX_FRAMES_IN_FLIGHT] = {};
+	LightSetup light_setup{};
+	std::vector<SceneLight> scene_lights;
+	bool brute_force_lighting = false; // B to toggle
+	uint64_t frame_number = 0;
+	LightingStats lighting_stats[2]; // Clustered, brute force
+	FrameTimer binning_timer;
+
+	// Occlusion Culling
+	VkDescriptorSetLayout cull_set_layout = VK_NULL_HANDLE;
+	VkPipelineLayout cull_pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline cull_pipeline = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> cull_descriptor_sets;
+	VkDescriptorSetLayout depth_reduce_set_layout = VK_NULL_HANDLE;
+	VkPipelineLayout depth_reduce_pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline depth_reduce_pipeline = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> depth_reduce_descriptor_sets; // One per pyramid level
+	VkImage depth_pyramid = VK_NULL_HANDLE;
+	VkDeviceMemory depth_pyramid_memory = VK_NULL_HANDLE;
+	VkImageView depth_pyramid_view = VK_NULL_HANDLE; // All levels, sampled by the cull shader
+	std::vector<VkImageView> depth_pyramid_level_views;
+	VkExtent2D depth_pyramid_extent{};
+	uint32_t depth_pyramid_level_count = 0;
+	VkSampler depth_sampler = VK_NULL_HANDLE;
+	std::vector<AllocatedBuffer> draw_buffers; // Per frame in flight
+	std::vector<AllocatedBuffer> indirect_buffers;
+	std::vector<AllocatedBuffer> cull_stats_buffers;
+	AllocatedBuffer visibility_buffer; // Carried from frame to frame, queue order keeps it coherent
+	bool occlusion_culling = true; // C to toggle
+	bool cull_stats_pending[MAX_FRAMES_IN_FLIGHT] = {};
+	bool frame_culling[MAX_FRAMES_IN_FLIGHT] = {}; // Culling mode each frame in flight was recorded with
+	CullingStats culling_stats;
+	FrameTimer culling_gpu_timers[2]; // Culling off, on
+
+	// Dynamic Resolution
+	VkImage scene_color_image = VK_NULL_HANDLE; // Sized for the largest scale, shared by all frames like the depth buffer
+	VkDeviceMemory scene_color_memory = VK_NULL_HANDLE;
+	VkImageView scene_color_view = VK_NULL_HANDLE;
+	VkFramebuffer scene_framebuffer = VK_NULL_HANDLE;
+	VkExtent2D render_target_extent{}; // Allocated size of the scene color and depth
+	VkExtent2D render_extent{}; // The sub-rect this frame renders into
+	VkSampler scene_sampler = VK_NULL_HANDLE;
+	VkDescriptorSetLayout upscale_set_layout = VK_NULL_HANDLE;
+	VkPipelineLayout upscale_pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline upscale_pipeline = VK_NULL_HANDLE;
+	VkDescriptorSet upscale_descriptor_set = VK_NULL_HANDLE;
+	ResolutionController resolution_controller;
+	float frame_scale[MAX_FRAMES_IN_FLIGHT] = {}; // Scale each frame in flight was rendered at, tags its GPU time
+	bool dynamic_resolution = true; // R to toggle
+
+	// Per frame inputs, rebuilt every frame (or read from a capture)
+	FrameInputs frame_inputs;
+	CapturedPipelineState pipeline_state{};
+
+	// Capture / Replay
+	FrameCapture capture;
+	bool capture_written = false;
+	FrameCapture replay_capture;
+	VkImage replay_image = VK_NULL_HANDLE; // Replays render offscreen so presentation and vsync stay out of the timings
+	VkDeviceMemory replay_image_memory;
+	VkImageView replay_image_view;
+	VkFramebuffer replay_framebuffer;
+
+	// GPU Timing
+	static constexpr uint32_t TIMESTAMPS_PER_FRAME = 3; // Frame start, light binning done, frame end
+	VkQueryPool timestamp_query_pool = VK_NULL_HANDLE;
+	float timestamp_period = 0.0f; // Nanoseconds per tick
+	bool timestamps_pending[MAX_FRAMES_IN_FLIGHT] = {};
+	FrameTimer gpu_frame_timer;
+
+	// Mesh Statistics
+	VkQueryPool statistics_query_pool = VK_NULL_HANDLE; // Only when pipelineStatisticsQuery is supported
+	bool statistics_pending[MAX_FRAMES_IN_FLIGHT] = {};
+	int statistics_mode[MAX_FRAMES_IN_FLIGHT] = {};
+	MeshStats mesh_stats[4];
 
 	const std::vector<const char *> validation_layers = {
 		"VK_LAYER_KHRONOS_validation"
@@ -128,28 +426,369 @@ private:
 	{
 		create_instance();
 		setup_debug_messenger();
-		create_surface();
-		pick_physical_device();
-		create_logical_device();
-		create_swap_chain();
+		if (config.mode == RunMode::Replay) {
+			pick_physical_device();
+			create_logical_device();
+			create_offscreen_target();
+		}
+		else {
+			create_surface();
+			pick_physical_device();
+			create_logical_device();
+			create_swap_chain();
+		}
 		create_image_views();
 		create_render_pass();
+		create_descriptor_set_layout();
+		create_culling_set_layouts();
 		create_graphics_pipeline();
+		create_upscale_pipeline();
+		create_compute_pipelines();
+		create_scene_target();
+		create_depth_resources();
+		create_framebuffers();
+		create_replay_target();
+		create_command_pool();
+		create_depth_pyramid();
+		load_scene();
+		create_vertex_buffer();
+		create_index_buffer();
+		create_lighting_buffers();
+		create_culling_buffers();
+		create_descriptor_pool();
+		create_descriptor_sets();
+		create_culling_descriptor_sets();
+		create_upscale_descriptor_set();
+		create_query_pools();
+		create_command_buffers();
+		create_sync_objects();
 	}
 	void main_loop()
 	{
+		glfwSetWindowUserPointer(WINDOW, this);
+		glfwSetWindowRefreshCallback(WINDOW, window_refresh_callback);
+		glfwSetWindowIconifyCallback(WINDOW, window_iconify_callback);
+		glfwSetInputMode(WINDOW, GLFW_STICKY_KEYS, GLFW_TRUE); // A press and release inside one wait still registers
+		animating = !config.on_demand;
+
+		bool l_was_down = false;
+		bool o_was_down = false;
+		bool b_was_down = false;
+		bool c_was_down = false;
+		bool r_was_down = false;
+		bool p_was_down = false;
+		bool v_was_down = false;
+		double last_time = glfwGetTime();
 		while (!window.should_close())
 		{
-			glfwPollEvents();
+			// Minimized: there is nothing to present to (the framebuffer is 0x0), so don't render at all until restored.
+			// The scene clock stays paused rather than jumping ahead by the time spent minimized.
+			if (window_minimized()) {
+				activity.begin_iteration();
+				glfwWaitEventsTimeout(IDLE_WAIT_SECONDS);
+				activity.end_iteration(false, 0);
+				last_time = glfwGetTime();
+				continue;
+			}
+
+			// Nothing changed and nothing animating: sleep until an event arrives instead of spinning.
+			// The timeout keeps the loop from stalling completely if an event gets lost.
+			bool idle = config.on_demand && !animating && (dirty & DIRTY_RENDER) == 0;
+			activity.begin_iteration();
+			if (idle) {
+				glfwWaitEventsTimeout(IDLE_WAIT_SECONDS);
+				activity.end_wait();
+			}
+			else {
+				glfwPollEvents();
+			}
+			frame_timer.begin_frame();
+
+			if (key_pressed(GLFW_KEY_L, l_was_down)) toggle_setting(lod_enabled);
+			if (key_pressed(GLFW_KEY_O, o_was_down)) toggle_setting(mesh_optimized);
+			if (key_pressed(GLFW_KEY_B, b_was_down)) toggle_setting(brute_force_lighting);
+			if (key_pressed(GLFW_KEY_C, c_was_down)) toggle_setting(occlusion_culling);
+			if (key_pressed(GLFW_KEY_R, r_was_down)) {
+				toggle_setting(dynamic_resolution);
+				resolution_controller.reset();
+			}
+			// Pausing leaves the last frame valid, resuming marks DIRTY_ANIMATION below
+			if (key_pressed(GLFW_KEY_P, p_was_down)) animating = !animating;
+			if (key_pressed(GLFW_KEY_V, v_was_down)) {
+				std::cout << "validation messages: " << Diagnostics::severity_name(diagnostics.cycle_min_severity()) << " and above" << std::endl;
+			}
+
+			double now = glfwGetTime();
+			if (animating) {
+				scene_time += now - last_time;
+				dirty |= DIRTY_ANIMATION;
+			}
+			last_time = now;
+
+			// Continuous mode redraws every iteration, and captures need consecutive frames
+			if (!config.on_demand || (!config.capture_path.empty() && !capture_written)) dirty |= DIRTY_SCENE;
+
+			uint32_t frames_presented = 0;
+			bool rendered = (dirty & DIRTY_RENDER) != 0;
+			if (rendered) {
+				if (draw_frame(true)) {
+					frame_timer.end_frame();
+					frames_presented = 1;
+				}
+			}
+			else if (dirty & DIRTY_WINDOW) {
+				if (draw_frame(false)) frames_presented = 1;
+			}
+			// A frame lost to swapchain recreation keeps its dirty flags and is drawn on the next iteration
+			if (frames_presented > 0) {
+				diagnostics.end_frame();
+				dirty = DIRTY_NONE;
+			}
+			activity.end_iteration(rendered, frames_presented);
 		}
+
+		vkDeviceWaitIdle(device);
+	}
+
+	bool window_minimized() {
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(WINDOW, &width, &height);
+		return width == 0 || height == 0 || glfwGetWindowAttrib(WINDOW, GLFW_ICONIFIED);
+	}
+
+	// Edge triggered
+	bool key_pressed(int key, bool& was_down) {
+		bool down = glfwGetKey(WINDOW, key) == GLFW_PRESS;
+		bool pressed = down && !was_down;
+		was_down = down;
+		return pressed;
+	}
+
+	// Render settings change the image (or the work behind it), so the scene is drawn again
+	void toggle_setting(bool& setting) {
+		setting = !setting;
+		dirty |= DIRTY_SCENE;
+	}
+
+	static void window_refresh_callback(GLFWwindow* glfw_window) {
+		static_cast<Application*>(glfwGetWindowUserPointer(glfw_window))->dirty |= DIRTY_WINDOW;
+	}
+
+	static void window_iconify_callback(GLFWwindow* glfw_window, int iconified) {
+		if (!iconified) static_cast<Application*>(glfwGetWindowUserPointer(glfw_window))->dirty |= DIRTY_WINDOW;
+	}
+
+	// render_scene false re-presents the last rendered frame without touching the scene.
+	// Returns false when the swapchain was out of date and nothing was submitted.
+	bool draw_frame(bool render_scene) {
+		vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+		collect_statistics(current_frame);
+		collect_timestamps(current_frame);
+		collect_cluster_stats(current_frame);
+		collect_cull_stats(current_frame);
+
+		uint32_t image_index;
+		VkResult result = vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX, image_available_semaphores[current_frame], VK_NULL_HANDLE, &image_index);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			recreate_swap_chain();
+			return false;
+		}
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+			throw std::runtime_error("Failed to acquire swap chain image!");
+		}
+
+		// Previous frame using this image may still be in flight
+		if (images_in_flight[image_index] != VK_NULL_HANDLE) {
+			vkWaitForFences(device, 1, &images_in_flight[image_index], VK_TRUE, UINT64_MAX);
+		}
+		images_in_flight[image_index] = in_flight_fences[current_frame];
+
+		vkResetCommandBuffer(command_buffers[current_frame], 0);
+		if (render_scene) {
+			build_frame(frame_inputs);
+			capture_frame(frame_inputs);
+			record_command_buffer(command_buffers[current_frame], swap_chain_framebuffers[image_index], frame_inputs);
+		}
+		else {
+			record_present_command_buffer(command_buffers[current_frame], swap_chain_framebuffers[image_index]);
+		}
+
+		VkSemaphore wait_semaphores[] = { image_available_semaphores[current_frame] };
+		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+		VkSemaphore signal_semaphores[] = { render_finished_semaphores[current_frame] };
+
+		VkSubmitInfo submit_info{};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.waitSemaphoreCount = 1;
+		submit_info.pWaitSemaphores = wait_semaphores;
+		submit_info.pWaitDstStageMask = wait_stages;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &command_buffers[current_frame];
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = signal_semaphores;
+
+		vkResetFences(device, 1, &in_flight_fences[current_frame]);
+		if (vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fences[current_frame]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to submit draw command buffer!");
+		}
+
+		VkPresentInfoKHR present_info{};
+		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		present_info.waitSemaphoreCount = 1;
+		present_info.pWaitSemaphores = signal_semaphores;
+		present_info.swapchainCount = 1;
+		present_info.pSwapchains = &swap_chain;
+		present_info.pImageIndices = &image_index;
+
+		result = vkQueuePresentKHR(present_queue, &present_info);
+		current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+		// Suboptimal still presented, rebuild anyway so the next frames match the surface
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+			recreate_swap_chain();
+		}
+		else if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to present swap chain image!");
+		}
+		return true;
 	}
 	/* END INITIALIZATION AND MAIN LOOP */
 
 
+	/* CAPTURE AND REPLAY */
+	void capture_frame(const FrameInputs& inputs) {
+		if (config.capture_path.empty() || capture_written) return;
+
+		// The light list is regenerated on replay, only the time it was animated to is kept
+		capture.frames.push_back(FrameInputs{ inputs.camera, {}, inputs.light_time, inputs.draws });
+		if (capture.frames.size() < config.capture_frames) return;
+
+		capture.pipeline_state = pipeline_state;
+		capture.mesh = mesh;
+		capture.lights = light_setup;
+		write_capture(config.capture_path, capture);
+		capture_written = true;
+		std::cout << "Captured " << capture.frames.size() << " frames to " << config.capture_path << std::endl;
+		capture = FrameCapture{};
+	}
+
+	// Runs the captured frames through the renderer config.replay_iterations times, after one untimed warm up pass.
+	// Every iteration replays the frames once with occlusion culling and once without, so report_culling_stats
+	// compares the two modes on exactly the same work. cpu and gpu totals cover both.
+	// Fully offscreen: no window, surface or swapchain, frames go to replay_framebuffer and are never presented.
+	void replay() {
+		if (!(replay_capture.pipeline_state == pipeline_state)) {
+			std::cout << "Warning: pipeline state differs from the one the capture was recorded with" << std::endl;
+		}
+		std::cout << "Replaying " << replay_capture.frames.size() << " frames x " << config.replay_iterations << " iterations x culling on/off" << std::endl;
+
+		FrameTimer cpu_timer;
+		for (uint32_t iteration = 0; iteration <= config.replay_iterations; iteration++) {
+			// Everything the warm up pass accumulated is collected and thrown away, timers and counters alike
+			if (iteration == 1) {
+				vkDeviceWaitIdle(device);
+				for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+					collect_statistics(i);
+					collect_timestamps(i);
+					collect_cluster_stats(i);
+					collect_cull_stats(i);
+				}
+				gpu_frame_timer.reset();
+				binning_timer.reset();
+				culling_gpu_timers[0].reset();
+				culling_gpu_timers[1].reset();
+				culling_stats = CullingStats{};
+				lighting_stats[0] = LightingStats{};
+				lighting_stats[1] = LightingStats{};
+				for (auto& stats : mesh_stats) stats = MeshStats{};
+			}
+
+			for (bool culling : { true, false }) {
+				occlusion_culling = culling;
+				for (const auto& frame : replay_capture.frames) {
+					vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+					collect_statistics(current_frame);
+					collect_timestamps(current_frame);
+					collect_cluster_stats(current_frame);
+					collect_cull_stats(current_frame);
+
+					// CPU frame time is recording plus submission
+					cpu_timer.begin_frame();
+					vkResetCommandBuffer(command_buffers[current_frame], 0);
+					record_command_buffer(command_buffers[current_frame], replay_framebuffer, frame);
+
+					VkSubmitInfo submit_info{};
+					submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+					submit_info.commandBufferCount = 1;
+					submit_info.pCommandBuffers = &command_buffers[current_frame];
+
+					vkResetFences(device, 1, &in_flight_fences[current_frame]);
+					if (vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fences[current_frame]) != VK_SUCCESS) {
+						throw std::runtime_error("Failed to submit replay command buffer!");
+					}
+					if (iteration > 0) cpu_timer.end_frame();
+					diagnostics.end_frame();
+
+					current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+				}
+			}
+		}
+
+		vkDeviceWaitIdle(device);
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			collect_timestamps(i);
+			collect_cluster_stats(i);
+			collect_cull_stats(i);
+		}
+
+		cpu_timer.report("replay cpu");
+		if (timestamp_query_pool != VK_NULL_HANDLE) {
+			gpu_frame_timer.report("replay gpu");
+			binning_timer.report("replay light binning");
+		}
+		else {
+			std::cout << "replay gpu: timestamps not supported on the graphics queue" << std::endl;
+		}
+		report_culling_stats();
+	}
+
+	// Stands in for create_swap_chain when replaying. The extent comes from the capture header so the frames are
+	// rendered at the size they were recorded at, the format is one every device can render to.
+	void create_offscreen_target() {
+		replay_capture = read_capture(config.replay_path);
+		swap_chain_image_format = VK_FORMAT_B8G8R8A8_SRGB;
+		swap_chain_extent = { replay_capture.pipeline_state.extent_width, replay_capture.pipeline_state.extent_height };
+		if (swap_chain_extent.width == 0 || swap_chain_extent.height == 0) {
+			throw std::runtime_error("Capture has an empty extent!");
+		}
+	}
+
+	void create_replay_target() {
+		if (config.mode != RunMode::Replay) return;
+
+		create_image(swap_chain_extent.width, swap_chain_extent.height, swap_chain_image_format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, replay_image, replay_image_memory);
+		replay_image_view = create_image_view(replay_image, swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		VkFramebufferCreateInfo framebuffer_info{};
+		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_info.renderPass = present_render_pass;
+		framebuffer_info.attachmentCount = 1;
+		framebuffer_info.pAttachments = &replay_image_view;
+		framebuffer_info.width = swap_chain_extent.width;
+		framebuffer_info.height = swap_chain_extent.height;
+		framebuffer_info.layers = 1;
+
+		if (vkCreateFramebuffer(device, &framebuffer_info, nullptr, &replay_framebuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create replay framebuffer!");
+		}
+	}
+	/* END CAPTURE AND REPLAY */
+
+
 	/* GRAPHICS PIPELINE */
 	void create_graphics_pipeline() {
-		auto triangle_vert_code = read_file("shaderout/vert.spv");
-		auto triangle_frag_code = read_file("shaderout/frag.spv");
+		auto triangle_vert_code = read_file("shaderout/mesh_vert.spv");
+		auto triangle_frag_code = read_file("shaderout/mesh_frag.spv");
 		VkShaderModule triangle_vert_module = create_shader_module(triangle_vert_code);
 		VkShaderModule triangle_frag_module = create_shader_module(triangle_frag_code);
 
@@ -171,36 +810,32 @@ private:
 
 		VkPipelineShaderStageCreateInfo shader_stages[] = { triangle_vert_shader_stage_info, triangle_frag_shader_stage_info };
 
+		auto binding_description = PackedVertex::get_binding_description();
+		auto attribute_descriptions = PackedVertex::get_attribute_descriptions();
+
 		VkPipelineVertexInputStateCreateInfo vertex_input_info{};
 		vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertex_input_info.vertexBindingDescriptionCount = 0;
-		vertex_input_info.pVertexBindingDescriptions = nullptr;
-		vertex_input_info.vertexAttributeDescriptionCount = 0;
-		vertex_input_info.pVertexAttributeDescriptions = nullptr;
+		vertex_input_info.vertexBindingDescriptionCount = 1;
+		vertex_input_info.pVertexBindingDescriptions = &binding_description;
+		vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attribute_descriptions.size());
+		vertex_input_info.pVertexAttributeDescriptions = attribute_descriptions.data();
 
 		VkPipelineInputAssemblyStateCreateInfo input_assembly{};
 		input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 		input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 		input_assembly.primitiveRestartEnable = VK_FALSE;
 
-		VkViewport viewport{};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)swap_chain_extent.width;
-		viewport.height = (float)swap_chain_extent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 0.0f;
-
-		VkRect2D scissor{};
-		scissor.offset = { 0, 0 };
-		scissor.extent = swap_chain_extent;
-
+		// Viewport and scissor follow the dynamic resolution sub-rect, they're set when the scene passes are recorded
 		VkPipelineViewportStateCreateInfo viewport_state{};
 		viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 		viewport_state.viewportCount = 1;
-		viewport_state.pViewports = &viewport;
 		viewport_state.scissorCount = 1;
-		viewport_state.pScissors = &scissor;
+
+		VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamic_state{};
+		dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamic_state.dynamicStateCount = 2;
+		dynamic_state.pDynamicStates = dynamic_states;
 
 		VkPipelineRasterizationStateCreateInfo rasterizer{};
 		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -209,7 +844,7 @@ private:
 		rasterizer.polygonMode = VK_POLYGON_MODE_FILL; // Could be LINE or POINT
 		rasterizer.lineWidth = 1.0f;
 		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-		rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE; // Projection flips Y
 		rasterizer.depthBiasEnable = VK_FALSE;
 		rasterizer.depthBiasConstantFactor = 0.0f; // Optional
 		rasterizer.depthBiasClamp = 0.0f; // Optional
@@ -245,11 +880,19 @@ private:
 		color_blending.blendConstants[2] = 0.0f; // Optional
 		color_blending.blendConstants[3] = 0.0f; // Optional
 
-		// Used for uniform values in shaders
+		VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+		depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depth_stencil.depthTestEnable = VK_TRUE;
+		depth_stencil.depthWriteEnable = VK_TRUE;
+		depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+		depth_stencil.depthBoundsTestEnable = VK_FALSE;
+		depth_stencil.stencilTestEnable = VK_FALSE;
+
+		// Used for uniform values in shaders. Per draw transform and dequantization come from the draw buffer.
 		VkPipelineLayoutCreateInfo pipeline_layout_info{};
 		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipeline_layout_info.setLayoutCount = 0;
-		pipeline_layout_info.pSetLayouts = nullptr;
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
 		pipeline_layout_info.pushConstantRangeCount = 0;
 		pipeline_layout_info.pPushConstantRanges = nullptr;
 
@@ -267,9 +910,9 @@ private:
 		pipeline_info.pViewportState = &viewport_state;
 		pipeline_info.pRasterizationState = &rasterizer;
 		pipeline_info.pMultisampleState = &multisampling;
-		pipeline_info.pDepthStencilState = nullptr; // Optional
+		pipeline_info.pDepthStencilState = &depth_stencil;
 		pipeline_info.pColorBlendState = &color_blending;
-		pipeline_info.pDynamicState = nullptr; // Optional
+		pipeline_info.pDynamicState = &dynamic_state;
 		pipeline_info.layout = pipeline_layout;
 		pipeline_info.renderPass = render_pass;
 		pipeline_info.subpass = 0;
@@ -280,11 +923,22 @@ private:
 			throw std::runtime_error("Failed to create graphics pipeline!");
 		}
 
+		// Recorded into captures so replays can tell when they run against different state
+		pipeline_state.extent_width = swap_chain_extent.width;
+		pipeline_state.extent_height = swap_chain_extent.height;
+		pipeline_state.topology = input_assembly.topology;
+		pipeline_state.polygon_mode = rasterizer.polygonMode;
+		pipeline_state.cull_mode = rasterizer.cullMode;
+		pipeline_state.front_face = rasterizer.frontFace;
+		pipeline_state.vertex_stride = binding_description.stride;
+
 		vkDestroyShaderModule(device, triangle_frag_module, nullptr);
 		vkDestroyShaderModule(device, triangle_vert_module, nullptr);
 	}
 
 	void create_render_pass() {
+		depth_format = find_depth_format();
+
 		VkAttachmentDescription color_attachment{};
 		color_attachment.format = swap_chain_image_format;
 		color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -293,35 +947,131 @@ private:
 		color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		// Stored and left readable so the depth pyramid can be built from it between the passes
+		VkAttachmentDescription depth_attachment{};
+		depth_attachment.format = depth_format;
+		depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
 		// Subpasses
 		VkAttachmentReference color_attachment_ref{};
 		color_attachment_ref.attachment = 0;
 		color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+		VkAttachmentReference depth_attachment_ref{};
+		depth_attachment_ref.attachment = 1;
+		depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
 		VkSubpassDescription subpass{};
 		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 		subpass.colorAttachmentCount = 1;
 		subpass.pColorAttachments = &color_attachment_ref;
+		subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+		// Attachments are shared with the other pass and the previous frame, depth is read by the pyramid build
+		// and color by the upscale pass
+		VkSubpassDependency dependencies[2]{};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+		VkAttachmentDescription attachments[] = { color_attachment, depth_attachment };
 
 		VkRenderPassCreateInfo render_pass_info{};
 		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		render_pass_info.attachmentCount = 1;
-		render_pass_info.pAttachments = &color_attachment;
+		render_pass_info.attachmentCount = 2;
+		render_pass_info.pAttachments = attachments;
 		render_pass_info.subpassCount = 1;
 		render_pass_info.pSubpasses = &subpass;
+		render_pass_info.dependencyCount = 2;
+		render_pass_info.pDependencies = dependencies;
 
 		if (vkCreateRenderPass(device, &render_pass_info, nullptr, &render_pass) != VK_SUCCESS) {
 			throw std::runtime_error("Failed to create render pass!");
 		}
+
+		// Late pass: continues on top of the early pass and hands the scene color to the upscale pass.
+		// Only load/store ops and layouts differ, so it stays compatible with the same pipeline and framebuffer.
+		attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		attachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		if (vkCreateRenderPass(device, &render_pass_info, nullptr, &late_render_pass) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create late render pass!");
+		}
+
+		// Present pass: the upscale overwrites every pixel, so the old contents are never loaded.
+		// Replay renders into its own image without VK_KHR_swapchain, so that variant ends in an attachment layout
+		VkAttachmentDescription present_attachment = color_attachment;
+		present_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		present_attachment.finalLayout = config.mode == RunMode::Replay ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+		VkSubpassDescription present_subpass{};
+		present_subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		present_subpass.colorAttachmentCount = 1;
+		present_subpass.pColorAttachments = &color_attachment_ref;
+
+		// Waits for the swapchain image, the acquire semaphore is waited on at this stage
+		VkSubpassDependency present_dependency{};
+		present_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		present_dependency.dstSubpass = 0;
+		present_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		present_dependency.srcAccessMask = 0;
+		present_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		present_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+		render_pass_info.attachmentCount = 1;
+		render_pass_info.pAttachments = &present_attachment;
+		render_pass_info.pSubpasses = &present_subpass;
+		render_pass_info.dependencyCount = 1;
+		render_pass_info.pDependencies = &present_dependency;
+
+		if (vkCreateRenderPass(device, &render_pass_info, nullptr, &present_render_pass) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create present render pass!");
+		}
+	}
+
+	VkFormat find_depth_format() {
+		// Sampled as well as rendered to, the depth pyramid is built from it
+		const VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT };
+		for (VkFormat format : candidates) {
+			VkFormatProperties properties;
+			vkGetPhysicalDeviceFormatProperties(physical_device, format, &properties);
+			VkFormatFeatureFlags required = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+			if ((properties.optimalTilingFeatures & required) == required) {
+				return format;
+			}
+		}
+
+		throw std::runtime_error("Failed to find a supported depth format!");
 	}
 
 	static std::vector<char>read_file(const std::string& filename) {
 		std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
 		if (!file.is_open()) {
-			throw std::runtime_error("Failed to open file!");
+			// Missing shaderout/*.spv means compile.bat hasn't run, the project's pre-build step calls it
+			throw std::runtime_error("Failed to open file " + filename + "!");
 		}
 
 		// Read in size
@@ -337,6 +1087,47 @@ private:
 
 	}
 
+	void create_compute_pipelines() {
+		create_compute_pipeline("shaderout/cluster_comp.spv", descriptor_set_layout, 0, cluster_pipeline_layout, cluster_pipeline);
+		create_compute_pipeline("shaderout/cull_comp.spv", cull_set_layout, sizeof(CullPushConstants), cull_pipeline_layout, cull_pipeline);
+		create_compute_pipeline("shaderout/depth_reduce_comp.spv", depth_reduce_set_layout, sizeof(DepthReducePushConstants), depth_reduce_pipeline_layout, depth_reduce_pipeline);
+	}
+
+	void create_compute_pipeline(const std::string& filename, VkDescriptorSetLayout set_layout, uint32_t push_constant_size, VkPipelineLayout& layout, VkPipeline& pipeline) {
+		auto comp_code = read_file(filename);
+		VkShaderModule comp_module = create_shader_module(comp_code);
+
+		VkPushConstantRange push_constant_range{};
+		push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		push_constant_range.offset = 0;
+		push_constant_range.size = push_constant_size;
+
+		VkPipelineLayoutCreateInfo pipeline_layout_info{};
+		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &set_layout;
+		pipeline_layout_info.pushConstantRangeCount = push_constant_size > 0 ? 1 : 0;
+		pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+		if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &layout) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create compute pipeline layout!");
+		}
+
+		VkComputePipelineCreateInfo pipeline_info{};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_info.stage.module = comp_module;
+		pipeline_info.stage.pName = "main";
+		pipeline_info.layout = layout;
+
+		if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create compute pipeline!");
+		}
+
+		vkDestroyShaderModule(device, comp_module, nullptr);
+	}
+
 	VkShaderModule create_shader_module(const std::vector<char>& code) {
 		VkShaderModuleCreateInfo create_info{};
 		create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -353,29 +1144,1286 @@ private:
 	/* END GRAPHICS PIPELINE */
 
 
+	/* COMMANDS AND SYNC */
+	void create_depth_resources() {
+		create_image(render_target_extent.width, render_target_extent.height, depth_format, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, depth_image, depth_image_memory);
+		depth_image_view = create_image_view(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT);
+	}
+
+	void create_framebuffers() {
+		VkImageView attachments[] = { scene_color_view, depth_image_view }; // One scene target, frames don't overlap on the queue
+
+		VkFramebufferCreateInfo framebuffer_info{};
+		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_info.renderPass = render_pass;
+		framebuffer_info.attachmentCount = 2;
+		framebuffer_info.pAttachments = attachments;
+		framebuffer_info.width = render_target_extent.width;
+		framebuffer_info.height = render_target_extent.height;
+		framebuffer_info.layers = 1;
+
+		if (vkCreateFramebuffer(device, &framebuffer_info, nullptr, &scene_framebuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create scene framebuffer!");
+		}
+
+		create_swap_chain_framebuffers();
+	}
+
+	void create_swap_chain_framebuffers() {
+		VkFramebufferCreateInfo framebuffer_info{};
+		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_info.renderPass = present_render_pass;
+		framebuffer_info.attachmentCount = 1;
+		framebuffer_info.width = swap_chain_extent.width;
+		framebuffer_info.height = swap_chain_extent.height;
+		framebuffer_info.layers = 1;
+
+		swap_chain_framebuffers.resize(swap_chain_image_views.size());
+		for (size_t i = 0; i < swap_chain_image_views.size(); i++) {
+			framebuffer_info.pAttachments = &swap_chain_image_views[i];
+
+			if (vkCreateFramebuffer(device, &framebuffer_info, nullptr, &swap_chain_framebuffers[i]) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to create framebuffer!");
+			}
+		}
+	}
+
+	void create_command_pool() {
+		QueueFamilyIndices queue_family_indices = find_queue_families(physical_device);
+
+		VkCommandPoolCreateInfo pool_info{};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Re-recorded every frame for LOD selection
+		pool_info.queueFamilyIndex = queue_family_indices.graphicsFamily.value();
+
+		if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pool) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create command pool!");
+		}
+	}
+
+	void create_command_buffers() {
+		command_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+		VkCommandBufferAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = command_pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandBufferCount = static_cast<uint32_t>(command_buffers.size());
+
+		if (vkAllocateCommandBuffers(device, &alloc_info, command_buffers.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate command buffers!");
+		}
+	}
+
+	void create_sync_objects() {
+		image_available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
+		render_finished_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
+		in_flight_fences.resize(MAX_FRAMES_IN_FLIGHT);
+		images_in_flight.resize(swap_chain_images.size(), VK_NULL_HANDLE);
+
+		VkSemaphoreCreateInfo semaphore_info{};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		VkFenceCreateInfo fence_info{};
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			if (vkCreateSemaphore(device, &semaphore_info, nullptr, &image_available_semaphores[i]) != VK_SUCCESS ||
+				vkCreateSemaphore(device, &semaphore_info, nullptr, &render_finished_semaphores[i]) != VK_SUCCESS ||
+				vkCreateFence(device, &fence_info, nullptr, &in_flight_fences[i]) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to create synchronization objects for a frame!");
+			}
+		}
+	}
+
+	// framebuffer is the output the scene gets upscaled into, the scene itself always draws into scene_framebuffer
+	void record_command_buffer(VkCommandBuffer command_buffer, VkFramebuffer framebuffer, const FrameInputs& inputs) {
+		update_render_extent();
+		update_lighting_buffers(inputs);
+		uint32_t draw_count = update_draw_buffer(inputs);
+
+		VkCommandBufferBeginInfo begin_info{};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to begin recording command buffer!");
+		}
+
+		uint32_t first_timestamp = (uint32_t)current_frame * TIMESTAMPS_PER_FRAME;
+		if (timestamp_query_pool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(command_buffer, timestamp_query_pool, first_timestamp, TIMESTAMPS_PER_FRAME);
+			vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool, first_timestamp);
+		}
+		if (statistics_query_pool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(command_buffer, statistics_query_pool, (uint32_t)current_frame, 1);
+			vkCmdBeginQuery(command_buffer, statistics_query_pool, (uint32_t)current_frame, 0);
+		}
+
+		record_light_binning(command_buffer);
+		if (timestamp_query_pool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, timestamp_query_pool, first_timestamp + 1);
+		}
+
+		// Early phase draws last frame's visible set, its depth feeds the pyramid the late phase tests against
+		bool culling = occlusion_culling;
+		record_cull(command_buffer, CULL_PHASE_EARLY, draw_count, culling);
+		record_scene_pass(command_buffer, render_pass, 0, draw_count);
+		if (culling) {
+			record_depth_pyramid(command_buffer);
+			record_cull(command_buffer, CULL_PHASE_LATE, draw_count, culling);
+		}
+		else {
+			reset_visibility(command_buffer);
+		}
+		record_scene_pass(command_buffer, late_render_pass, MAX_SCENE_DRAWS, culling ? draw_count : 0);
+		frame_culling[current_frame] = culling;
+		cull_stats_pending[current_frame] = true;
+
+		// Make the cull and fragment shader stat counters visible to the host once the fence signals
+		VkMemoryBarrier host_barrier{};
+		host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		host_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier, 0, nullptr, 0, nullptr);
+
+		if (statistics_query_pool != VK_NULL_HANDLE) {
+			vkCmdEndQuery(command_buffer, statistics_query_pool, (uint32_t)current_frame);
+			statistics_pending[current_frame] = true;
+			statistics_mode[current_frame] = stats_mode();
+		}
+
+		record_upscale_pass(command_buffer, framebuffer);
+
+		if (timestamp_query_pool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool, first_timestamp + 2);
+			timestamps_pending[current_frame] = true;
+		}
+
+		if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to record command buffer!");
+		}
+	}
+	// The scene target still holds the last rendered frame, so presenting it again only needs the upscale pass
+	void record_present_command_buffer(VkCommandBuffer command_buffer, VkFramebuffer framebuffer) {
+		VkCommandBufferBeginInfo begin_info{};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to begin recording command buffer!");
+		}
+		record_upscale_pass(command_buffer, framebuffer);
+		if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to record command buffer!");
+		}
+	}
+
+	// One pass over the scene, drawing whatever the cull shader left in the indirect buffer at command_offset
+	void record_scene_pass(VkCommandBuffer command_buffer, VkRenderPass pass, uint32_t command_offset, uint32_t draw_count) {
+		VkClearValue clear_values[2]{};
+		clear_values[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+		clear_values[1].depthStencil = { 1.0f, 0 };
+
+		VkRenderPassBeginInfo render_pass_info{};
+		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		render_pass_info.renderPass = pass;
+		render_pass_info.framebuffer = scene_framebuffer;
+		render_pass_info.renderArea.offset = { 0, 0 };
+		render_pass_info.renderArea.extent = render_extent;
+		render_pass_info.clearValueCount = 2;
+		render_pass_info.pClearValues = clear_values;
+
+		vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+		if (draw_count > 0) {
+			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &descriptor_sets[current_frame], 0, nullptr);
+
+			VkViewport viewport{};
+			viewport.width = (float)render_extent.width;
+			viewport.height = (float)render_extent.height;
+			viewport.minDepth = 0.0f;
+			viewport.maxDepth = 1.0f;
+			VkRect2D scissor{ { 0, 0 }, render_extent };
+			vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+			vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+			VkBuffer vertex_buffers[] = { vertex_buffer };
+			VkDeviceSize offsets[] = { 0 };
+			vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+			vkCmdBindIndexBuffer(command_buffer, index_buffer, 0, VK_INDEX_TYPE_UINT32);
+
+			// Culled draws have an instance count of 0 and never reach the vertex stage
+			vkCmdDrawIndexedIndirect(command_buffer, indirect_buffers[current_frame].buffer, sizeof(VkDrawIndexedIndirectCommand) * command_offset, draw_count, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		vkCmdEndRenderPass(command_buffer);
+	}
+	/* END COMMANDS AND SYNC */
+
+
+	/* CLUSTERED LIGHTING */
+	void create_descriptor_set_layout() {
+		// 0 frame uniforms, 1 lights, 2 cluster grid, 3 light indices, 4 stats, 5 draws. Shared by the binning and forward pass.
+		VkDescriptorSetLayoutBinding bindings[6]{};
+		for (uint32_t i = 0; i < 6; i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		}
+		bindings[0].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+		bindings[5].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layout_info{};
+		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_info.bindingCount = 6;
+		layout_info.pBindings = bindings;
+
+		if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &descriptor_set_layout) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create descriptor set layout!");
+		}
+	}
+
+	void create_lighting_buffers() {
+		const VkMemoryPropertyFlags host_visible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+		uniform_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+		light_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+		cluster_grid_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+		light_index_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+		cluster_stats_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			// Written by the CPU every frame
+			create_mapped_buffer(sizeof(FrameUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, host_visible, uniform_buffers[i]);
+			create_mapped_buffer(sizeof(GpuLight) * MAX_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_visible, light_buffers[i]);
+			// Written and read on the GPU only
+			create_buffer(sizeof(uint32_t) * 2 * CLUSTER_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cluster_grid_buffers[i].buffer, cluster_grid_buffers[i].memory);
+			create_buffer(sizeof(uint32_t) * LIGHT_INDEX_CAPACITY, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, light_index_buffers[i].buffer, light_index_buffers[i].memory);
+			// Cleared on the GPU, read back after the fence
+			create_mapped_buffer(sizeof(ClusterStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, host_visible, cluster_stats_buffers[i]);
+		}
+	}
+
+	// Holds every set: per frame forward/binning and cull sets, one depth reduce set per pyramid level and the upscale set
+	void create_descriptor_pool() {
+		VkDescriptorPoolSize pool_sizes[4]{};
+		pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		pool_sizes[0].descriptorCount = MAX_FRAMES_IN_FLIGHT * 2;
+		pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		pool_sizes[1].descriptorCount = MAX_FRAMES_IN_FLIGHT * (5 + 4);
+		pool_sizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		pool_sizes[2].descriptorCount = MAX_FRAMES_IN_FLIGHT + MAX_DEPTH_PYRAMID_LEVELS + 1;
+		pool_sizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		pool_sizes[3].descriptorCount = MAX_DEPTH_PYRAMID_LEVELS;
+
+		VkDescriptorPoolCreateInfo pool_info{};
+		pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_info.poolSizeCount = 4;
+		pool_info.pPoolSizes = pool_sizes;
+		pool_info.maxSets = MAX_FRAMES_IN_FLIGHT * 2 + MAX_DEPTH_PYRAMID_LEVELS + 1;
+
+		if (vkCreateDescriptorPool(device, &pool_info, nullptr, &descriptor_pool) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create descriptor pool!");
+		}
+	}
+
+	void create_descriptor_sets() {
+		std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptor_set_layout);
+		VkDescriptorSetAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.descriptorPool = descriptor_pool;
+		alloc_info.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+		alloc_info.pSetLayouts = layouts.data();
+
+		descriptor_sets.resize(MAX_FRAMES_IN_FLIGHT);
+		if (vkAllocateDescriptorSets(device, &alloc_info, descriptor_sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate descriptor sets!");
+		}
+
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			VkDescriptorBufferInfo buffer_infos[6] = {
+				{ uniform_buffers[i].buffer, 0, VK_WHOLE_SIZE },
+				{ light_buffers[i].buffer, 0, VK_WHOLE_SIZE },
+				{ cluster_grid_buffers[i].buffer, 0, VK_WHOLE_SIZE },
+				{ light_index_buffers[i].buffer, 0, VK_WHOLE_SIZE },
+				{ cluster_stats_buffers[i].buffer, 0, VK_WHOLE_SIZE },
+				{ draw_buffers[i].buffer, 0, VK_WHOLE_SIZE }
+			};
+
+			VkWriteDescriptorSet writes[6]{};
+			for (uint32_t binding = 0; binding < 6; binding++) {
+				writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[binding].dstSet = descriptor_sets[i];
+				writes[binding].dstBinding = binding;
+				writes[binding].descriptorCount = 1;
+				writes[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writes[binding].pBufferInfo = &buffer_infos[binding];
+			}
+			vkUpdateDescriptorSets(device, 6, writes, 0, nullptr);
+		}
+	}
+
+	// Called after the frame's fence, so the CPU writes can't race the GPU reading the previous contents
+	void update_lighting_buffers(const FrameInputs& inputs) {
+		uint32_t light_count = (uint32_t)std::min<size_t>(inputs.lights.size(), MAX_LIGHTS);
+		memcpy(light_buffers[current_frame].mapped, inputs.lights.data(), sizeof(GpuLight) * light_count);
+
+		// Atomics in the fragment shader aren't free, so stats are only gathered every 16th frame
+		bool collect_stats = frame_number++ % 16 == 0;
+		cluster_stats_pending[current_frame] = collect_stats;
+		cluster_stats_brute_force[current_frame] = brute_force_lighting;
+		cluster_stats_light_count[current_frame] = light_count;
+
+		FrameUniforms uniforms{};
+		uniforms.view = inputs.camera.view;
+		uniforms.proj = inputs.camera.proj;
+		uniforms.view_proj = inputs.camera.proj * inputs.camera.view;
+		uniforms.inverse_proj = glm::inverse(inputs.camera.proj);
+		uniforms.camera_position = inputs.camera.position;
+		uniforms.screen_size = glm::vec4(render_extent.width, render_extent.height, 1.0f / render_extent.width, 1.0f / render_extent.height);
+		uniforms.cluster_params = cluster_slice_params(CLUSTER_NEAR, FAR_PLANE);
+		uniforms.cluster_grid = glm::uvec4(CLUSTER_X, CLUSTER_Y, CLUSTER_Z, light_count);
+		uniforms.flags = glm::uvec4(collect_stats ? 1 : 0, brute_force_lighting ? 1 : 0, LIGHT_INDEX_CAPACITY, 0);
+		memcpy(uniform_buffers[current_frame].mapped, &uniforms, sizeof(uniforms));
+	}
+
+	// Bins the lights into clusters. Runs in brute force mode too, so the toggle only changes the shading cost.
+	void record_light_binning(VkCommandBuffer command_buffer) {
+		vkCmdFillBuffer(command_buffer, cluster_stats_buffers[current_frame].buffer, 0, VK_WHOLE_SIZE, 0);
+
+		VkMemoryBarrier clear_barrier{};
+		clear_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clear_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clear_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &clear_barrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cluster_pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cluster_pipeline_layout, 0, 1, &descriptor_sets[current_frame], 0, nullptr);
+		vkCmdDispatch(command_buffer, CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+
+		VkMemoryBarrier binning_barrier{};
+		binning_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		binning_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		binning_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &binning_barrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Called once the frame's fence has signalled
+	void collect_cluster_stats(size_t frame) {
+		if (!cluster_stats_pending[frame]) return;
+		cluster_stats_pending[frame] = false;
+
+		const ClusterStats& gpu_stats = *static_cast<const ClusterStats*>(cluster_stats_buffers[frame].mapped);
+		LightingStats& stats = lighting_stats[cluster_stats_brute_force[frame] ? 1 : 0];
+		stats.frames++;
+		stats.fragments += stats_counter(gpu_stats.fragments);
+		stats.lights_evaluated += stats_counter(gpu_stats.lights_evaluated);
+		stats.light_count += cluster_stats_light_count[frame];
+		if (gpu_stats.overflow > 0) stats.overflow_frames++;
+	}
+
+	void report_lighting_stats() {
+		const char* names[2] = { "clustered", "brute force" };
+		for (int i = 0; i < 2; i++) {
+			const LightingStats& stats = lighting_stats[i];
+			if (stats.frames == 0) continue;
+			std::cout << "lighting " << names[i] << ": " << stats.frames << " sampled frames, "
+				<< stats.light_count / stats.frames << " lights, "
+				<< (stats.fragments ? (double)stats.lights_evaluated / stats.fragments : 0.0) << " lights evaluated per fragment";
+			if (i == 0) std::cout << ", " << stats.overflow_frames << " frames overflowed a cluster list";
+			std::cout << std::endl;
+		}
+	}
+	/* END CLUSTERED LIGHTING */
+
+
+	/* OCCLUSION CULLING */
+	void create_culling_set_layouts() {
+		// 0 frame uniforms, 1 draws, 2 indirect commands, 3 visibility, 4 depth pyramid, 5 stats
+		VkDescriptorSetLayoutBinding cull_bindings[6]{};
+		for (uint32_t i = 0; i < 6; i++) {
+			cull_bindings[i].binding = i;
+			cull_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			cull_bindings[i].descriptorCount = 1;
+			cull_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		cull_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		cull_bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+		VkDescriptorSetLayoutCreateInfo layout_info{};
+		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_info.bindingCount = 6;
+		layout_info.pBindings = cull_bindings;
+
+		if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &cull_set_layout) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create cull descriptor set layout!");
+		}
+
+		// 0 source level, 1 destination level
+		VkDescriptorSetLayoutBinding reduce_bindings[2]{};
+		reduce_bindings[0].binding = 0;
+		reduce_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		reduce_bindings[0].descriptorCount = 1;
+		reduce_bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		reduce_bindings[1].binding = 1;
+		reduce_bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		reduce_bindings[1].descriptorCount = 1;
+		reduce_bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		layout_info.bindingCount = 2;
+		layout_info.pBindings = reduce_bindings;
+
+		if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &depth_reduce_set_layout) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create depth reduce descriptor set layout!");
+		}
+	}
+
+	// One pyramid for all frames in flight, frames run one after another on the queue.
+	// Sized for the full render target, at lower scales the reduction spreads the smaller rect over it.
+	void create_depth_pyramid() {
+		depth_pyramid_extent = { previous_pow2(render_target_extent.width), previous_pow2(render_target_extent.height) };
+		depth_pyramid_level_count = std::min(depth_pyramid_levels(depth_pyramid_extent.width, depth_pyramid_extent.height), MAX_DEPTH_PYRAMID_LEVELS);
+
+		create_image(depth_pyramid_extent.width, depth_pyramid_extent.height, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, depth_pyramid, depth_pyramid_memory, depth_pyramid_level_count);
+		depth_pyramid_view = create_image_view(depth_pyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, depth_pyramid_level_count);
+		depth_pyramid_level_views.resize(depth_pyramid_level_count);
+		for (uint32_t level = 0; level < depth_pyramid_level_count; level++) {
+			depth_pyramid_level_views[level] = create_image_view(depth_pyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, level, 1);
+		}
+
+		// Only read with texelFetch, filtering never applies
+		VkSamplerCreateInfo sampler_info{};
+		sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		sampler_info.magFilter = VK_FILTER_NEAREST;
+		sampler_info.minFilter = VK_FILTER_NEAREST;
+		sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.maxLod = (float)depth_pyramid_level_count;
+
+		if (vkCreateSampler(device, &sampler_info, nullptr, &depth_sampler) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create depth sampler!");
+		}
+
+		// Written as a storage image and sampled, it stays in GENERAL
+		VkCommandBuffer command_buffer = begin_single_time_commands();
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = depth_pyramid;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = depth_pyramid_level_count;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		end_single_time_commands(command_buffer);
+	}
+
+	void create_culling_buffers() {
+		const VkMemoryPropertyFlags host_visible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+		draw_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+		indirect_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+		cull_stats_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			create_mapped_buffer(sizeof(DrawCommand) * MAX_SCENE_DRAWS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_visible, draw_buffers[i]);
+			// Early commands in the first half, late commands in the second
+			create_buffer(sizeof(VkDrawIndexedIndirectCommand) * MAX_SCENE_DRAWS * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirect_buffers[i].buffer, indirect_buffers[i].memory);
+			create_mapped_buffer(sizeof(CullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, host_visible, cull_stats_buffers[i]);
+		}
+
+		// Nothing is visible before the first frame, so everything goes through the late phase once
+		create_buffer(sizeof(uint32_t) * MAX_SCENE_DRAWS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, visibility_buffer.buffer, visibility_buffer.memory);
+		VkCommandBuffer command_buffer = begin_single_time_commands();
+		vkCmdFillBuffer(command_buffer, visibility_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+		end_single_time_commands(command_buffer);
+	}
+
+	void create_culling_descriptor_sets() {
+		std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, cull_set_layout);
+		VkDescriptorSetAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.descriptorPool = descriptor_pool;
+		alloc_info.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+		alloc_info.pSetLayouts = layouts.data();
+
+		cull_descriptor_sets.resize(MAX_FRAMES_IN_FLIGHT);
+		if (vkAllocateDescriptorSets(device, &alloc_info, cull_descriptor_sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate cull descriptor sets!");
+		}
+
+		VkDescriptorImageInfo pyramid_info{ depth_sampler, depth_pyramid_view, VK_IMAGE_LAYOUT_GENERAL };
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			VkDescriptorBufferInfo buffer_infos[6] = {
+				{ uniform_buffers[i].buffer, 0, VK_WHOLE_SIZE },
+				{ draw_buffers[i].buffer, 0, VK_WHOLE_SIZE },
+				{ indirect_buffers[i].buffer, 0, VK_WHOLE_SIZE },
+				{ visibility_buffer.buffer, 0, VK_WHOLE_SIZE },
+				{},
+				{ cull_stats_buffers[i].buffer, 0, VK_WHOLE_SIZE }
+			};
+
+			VkWriteDescriptorSet writes[6]{};
+			for (uint32_t binding = 0; binding < 6; binding++) {
+				writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[binding].dstSet = cull_descriptor_sets[i];
+				writes[binding].dstBinding = binding;
+				writes[binding].descriptorCount = 1;
+				writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writes[binding].pBufferInfo = &buffer_infos[binding];
+			}
+			writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			writes[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writes[4].pBufferInfo = nullptr;
+			writes[4].pImageInfo = &pyramid_info;
+			vkUpdateDescriptorSets(device, 6, writes, 0, nullptr);
+		}
+
+		std::vector<VkDescriptorSetLayout> reduce_layouts(depth_pyramid_level_count, depth_reduce_set_layout);
+		alloc_info.descriptorSetCount = depth_pyramid_level_count;
+		alloc_info.pSetLayouts = reduce_layouts.data();
+
+		depth_reduce_descriptor_sets.resize(depth_pyramid_level_count);
+		if (vkAllocateDescriptorSets(device, &alloc_info, depth_reduce_descriptor_sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate depth reduce descriptor sets!");
+		}
+
+		for (uint32_t level = 0; level < depth_pyramid_level_count; level++) {
+			// Level 0 reduces the depth buffer itself
+			VkDescriptorImageInfo source_info{};
+			source_info.sampler = depth_sampler;
+			source_info.imageView = level == 0 ? depth_image_view : depth_pyramid_level_views[level - 1];
+			source_info.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+			VkDescriptorImageInfo destination_info{};
+			destination_info.imageView = depth_pyramid_level_views[level];
+			destination_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			VkWriteDescriptorSet writes[2]{};
+			writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[0].dstSet = depth_reduce_descriptor_sets[level];
+			writes[0].dstBinding = 0;
+			writes[0].descriptorCount = 1;
+			writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writes[0].pImageInfo = &source_info;
+			writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[1].dstSet = depth_reduce_descriptor_sets[level];
+			writes[1].dstBinding = 1;
+			writes[1].descriptorCount = 1;
+			writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[1].pImageInfo = &destination_info;
+			vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+		}
+	}
+
+	uint32_t update_draw_buffer(const FrameInputs& inputs) {
+		uint32_t draw_count = (uint32_t)std::min<size_t>(inputs.draws.size(), MAX_SCENE_DRAWS);
+		memcpy(draw_buffers[current_frame].mapped, inputs.draws.data(), sizeof(DrawCommand) * draw_count);
+		return draw_count;
+	}
+
+	// Writes this phase's indirect commands, see culling.h
+	void record_cull(VkCommandBuffer command_buffer, CullPhase phase, uint32_t draw_count, bool culling) {
+		if (phase == CULL_PHASE_EARLY) {
+			vkCmdFillBuffer(command_buffer, cull_stats_buffers[current_frame].buffer, 0, VK_WHOLE_SIZE, 0);
+		}
+
+		// Stats clear, last frame's visibility, this frame's depth pyramid
+		VkMemoryBarrier input_barrier{};
+		input_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		input_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		input_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &input_barrier, 0, nullptr, 0, nullptr);
+
+		CullPushConstants push_constants{};
+		push_constants.phase = phase;
+		push_constants.draw_count = draw_count;
+		push_constants.culling_enabled = culling ? 1 : 0;
+		push_constants.command_offset = phase == CULL_PHASE_EARLY ? 0 : MAX_SCENE_DRAWS;
+
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline_layout, 0, 1, &cull_descriptor_sets[current_frame], 0, nullptr);
+		vkCmdPushConstants(command_buffer, cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+		if (draw_count > 0) {
+			vkCmdDispatch(command_buffer, (draw_count + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+		}
+
+		VkMemoryBarrier command_barrier{};
+		command_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		command_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		command_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &command_barrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Without the late phase nothing refreshes the visibility buffer, so it's kept at all visible. Turning culling
+	// back on then starts by drawing everything early rather than from whatever set was visible when it was turned off.
+	void reset_visibility(VkCommandBuffer command_buffer) {
+		// The last late phase may still be reading and writing it
+		VkMemoryBarrier visibility_barrier{};
+		visibility_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		visibility_barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		visibility_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &visibility_barrier, 0, nullptr, 0, nullptr);
+		vkCmdFillBuffer(command_buffer, visibility_buffer.buffer, 0, VK_WHOLE_SIZE, 1);
+	}
+
+	// Reduces the early pass depth into the pyramid, one dispatch per level
+	void record_depth_pyramid(VkCommandBuffer command_buffer) {
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, depth_reduce_pipeline);
+
+		DepthReducePushConstants push_constants{};
+		push_constants.source_width = (int32_t)render_extent.width;
+		push_constants.source_height = (int32_t)render_extent.height;
+		for (uint32_t level = 0; level < depth_pyramid_level_count; level++) {
+			push_constants.destination_width = (int32_t)std::max(1u, depth_pyramid_extent.width >> level);
+			push_constants.destination_height = (int32_t)std::max(1u, depth_pyramid_extent.height >> level);
+
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, depth_reduce_pipeline_layout, 0, 1, &depth_reduce_descriptor_sets[level], 0, nullptr);
+			vkCmdPushConstants(command_buffer, depth_reduce_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+			vkCmdDispatch(command_buffer, (push_constants.destination_width + DEPTH_REDUCE_WORKGROUP_SIZE - 1) / DEPTH_REDUCE_WORKGROUP_SIZE, (push_constants.destination_height + DEPTH_REDUCE_WORKGROUP_SIZE - 1) / DEPTH_REDUCE_WORKGROUP_SIZE, 1);
+
+			VkMemoryBarrier level_barrier{};
+			level_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			level_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			level_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &level_barrier, 0, nullptr, 0, nullptr);
+
+			push_constants.source_width = push_constants.destination_width;
+			push_constants.source_height = push_constants.destination_height;
+		}
+	}
+
+	// Called once the frame's fence has signalled
+	void collect_cull_stats(size_t frame) {
+		if (!cull_stats_pending[frame]) return;
+		cull_stats_pending[frame] = false;
+		if (!frame_culling[frame]) return;
+
+		const CullStats& gpu_stats = *static_cast<const CullStats*>(cull_stats_buffers[frame].mapped);
+		culling_stats.frames++;
+		culling_stats.draws += gpu_stats.draws;
+		culling_stats.drawn_early += gpu_stats.drawn_early;
+		culling_stats.drawn_late += gpu_stats.drawn_late;
+		culling_stats.frustum_culled += gpu_stats.frustum_culled;
+		culling_stats.occlusion_culled += gpu_stats.occlusion_culled;
+	}
+
+	void report_culling_stats() {
+		const CullingStats& stats = culling_stats;
+		if (stats.frames > 0 && stats.draws > 0) {
+			double percent = 100.0 / stats.draws;
+			std::cout << "culling: " << stats.draws / stats.frames << " draws/frame, " << (stats.frustum_culled + stats.occlusion_culled) * percent << "% culled ("
+				<< stats.frustum_culled * percent << "% frustum, " << stats.occlusion_culled * percent << "% occlusion), "
+				<< stats.drawn_late * percent << "% drawn late as newly visible" << std::endl;
+		}
+		if (culling_gpu_timers[0].frame_count() > 0 && culling_gpu_timers[1].frame_count() > 0) {
+			culling_gpu_timers[0].report("gpu, culling off");
+			culling_gpu_timers[1].report("gpu, culling on");
+			std::cout << "culling saved " << culling_gpu_timers[0].average() - culling_gpu_timers[1].average() << " ms of gpu time per frame" << std::endl;
+		}
+	}
+	/* END OCCLUSION CULLING */
+
+
+	/* DYNAMIC RESOLUTION */
+	// Allocated once at the largest scale, lower scales render into a sub-rect so resizing never reallocates
+	void create_scene_target() {
+		resolution_controller.configure(config.resolution);
+		dynamic_resolution = config.mode == RunMode::Interactive;
+
+		render_target_extent = { scaled_dimension(swap_chain_extent.width, config.resolution.max_scale), scaled_dimension(swap_chain_extent.height, config.resolution.max_scale) };
+		render_extent = render_target_extent;
+
+		create_image(render_target_extent.width, render_target_extent.height, swap_chain_image_format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, scene_color_image, scene_color_memory);
+		scene_color_view = create_image_view(scene_color_image, swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		// Bilinear for the upscale, the shader keeps its taps inside the rendered rect
+		VkSamplerCreateInfo sampler_info{};
+		sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		sampler_info.magFilter = VK_FILTER_LINEAR;
+		sampler_info.minFilter = VK_FILTER_LINEAR;
+		sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.maxLod = 0.0f;
+
+		if (vkCreateSampler(device, &sampler_info, nullptr, &scene_sampler) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create scene sampler!");
+		}
+	}
+
+	// Full screen triangle sampling the scene color, no vertex input and no depth
+	void create_upscale_pipeline() {
+		VkDescriptorSetLayoutBinding binding{};
+		binding.binding = 0;
+		binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		binding.descriptorCount = 1;
+		binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layout_info{};
+		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_info.bindingCount = 1;
+		layout_info.pBindings = &binding;
+
+		if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &upscale_set_layout) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create upscale descriptor set layout!");
+		}
+
+		auto vert_code = read_file("shaderout/fullscreen_vert.spv");
+		auto frag_code = read_file("shaderout/upscale_frag.spv");
+		VkShaderModule vert_module = create_shader_module(vert_code);
+		VkShaderModule frag_module = create_shader_module(frag_code);
+
+		VkPipelineShaderStageCreateInfo shader_stages[2]{};
+		shader_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shader_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shader_stages[0].module = vert_module;
+		shader_stages[0].pName = "main";
+		shader_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shader_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shader_stages[1].module = frag_module;
+		shader_stages[1].pName = "main";
+
+		VkPipelineVertexInputStateCreateInfo vertex_input_info{};
+		vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+		VkPipelineInputAssemblyStateCreateInfo input_assembly{};
+		input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+		// Always the full output, set at record time so a recreated swapchain doesn't need a new pipeline
+		VkPipelineViewportStateCreateInfo viewport_state{};
+		viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewport_state.viewportCount = 1;
+		viewport_state.scissorCount = 1;
+
+		VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamic_state{};
+		dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamic_state.dynamicStateCount = 2;
+		dynamic_state.pDynamicStates = dynamic_states;
+
+		VkPipelineRasterizationStateCreateInfo rasterizer{};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterizer.lineWidth = 1.0f;
+		rasterizer.cullMode = VK_CULL_MODE_NONE;
+		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+		VkPipelineMultisampleStateCreateInfo multisampling{};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkPipelineColorBlendAttachmentState color_blend_attachment{};
+		color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		color_blend_attachment.blendEnable = VK_FALSE;
+
+		VkPipelineColorBlendStateCreateInfo color_blending{};
+		color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		color_blending.attachmentCount = 1;
+		color_blending.pAttachments = &color_blend_attachment;
+
+		VkPushConstantRange push_constant_range{};
+		push_constant_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		push_constant_range.offset = 0;
+		push_constant_range.size = sizeof(UpscalePushConstants);
+
+		VkPipelineLayoutCreateInfo pipeline_layout_info{};
+		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &upscale_set_layout;
+		pipeline_layout_info.pushConstantRangeCount = 1;
+		pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+		if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &upscale_pipeline_layout) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create upscale pipeline layout!");
+		}
+
+		VkGraphicsPipelineCreateInfo pipeline_info{};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipeline_info.stageCount = 2;
+		pipeline_info.pStages = shader_stages;
+		pipeline_info.pVertexInputState = &vertex_input_info;
+		pipeline_info.pInputAssemblyState = &input_assembly;
+		pipeline_info.pViewportState = &viewport_state;
+		pipeline_info.pRasterizationState = &rasterizer;
+		pipeline_info.pMultisampleState = &multisampling;
+		pipeline_info.pColorBlendState = &color_blending;
+		pipeline_info.pDynamicState = &dynamic_state;
+		pipeline_info.layout = upscale_pipeline_layout;
+		pipeline_info.renderPass = present_render_pass;
+		pipeline_info.subpass = 0;
+
+		if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &upscale_pipeline) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create upscale pipeline!");
+		}
+
+		vkDestroyShaderModule(device, frag_module, nullptr);
+		vkDestroyShaderModule(device, vert_module, nullptr);
+	}
+
+	void create_upscale_descriptor_set() {
+		VkDescriptorSetAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.descriptorPool = descriptor_pool;
+		alloc_info.descriptorSetCount = 1;
+		alloc_info.pSetLayouts = &upscale_set_layout;
+
+		if (vkAllocateDescriptorSets(device, &alloc_info, &upscale_descriptor_set) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate upscale descriptor set!");
+		}
+
+		VkDescriptorImageInfo scene_info{ scene_sampler, scene_color_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = upscale_descriptor_set;
+		write.dstBinding = 0;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &scene_info;
+		vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	}
+
+	// Picks this frame's sub-rect. Everything sized from it (viewport, cluster tiles, pyramid source) reads render_extent.
+	void update_render_extent() {
+		float scale = dynamic_resolution ? resolution_controller.current_scale() : config.resolution.max_scale;
+		render_extent.width = std::min(scaled_dimension(swap_chain_extent.width, scale), render_target_extent.width);
+		render_extent.height = std::min(scaled_dimension(swap_chain_extent.height, scale), render_target_extent.height);
+		frame_scale[current_frame] = scale;
+	}
+
+	// Stretches the rendered rect over the output framebuffer (swapchain image or replay target)
+	void record_upscale_pass(VkCommandBuffer command_buffer, VkFramebuffer framebuffer) {
+		VkRenderPassBeginInfo render_pass_info{};
+		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		render_pass_info.renderPass = present_render_pass;
+		render_pass_info.framebuffer = framebuffer;
+		render_pass_info.renderArea.offset = { 0, 0 };
+		render_pass_info.renderArea.extent = swap_chain_extent;
+
+		// Rendering at output size passes straight through, sharpening only makes up for upscaling blur
+		UpscalePushConstants push_constants{};
+		push_constants.uv_scale = glm::vec2(render_extent.width / (float)render_target_extent.width, render_extent.height / (float)render_target_extent.height);
+		push_constants.texel_size = glm::vec2(1.0f / render_target_extent.width, 1.0f / render_target_extent.height);
+		push_constants.sharpness = render_extent.width < swap_chain_extent.width ? config.resolution.sharpness : 0.0f;
+
+		vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, upscale_pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, upscale_pipeline_layout, 0, 1, &upscale_descriptor_set, 0, nullptr);
+
+		VkViewport viewport{};
+		viewport.width = (float)swap_chain_extent.width;
+		viewport.height = (float)swap_chain_extent.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		VkRect2D scissor{ { 0, 0 }, swap_chain_extent };
+		vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+		vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+		vkCmdPushConstants(command_buffer, upscale_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(push_constants), &push_constants);
+		vkCmdDraw(command_buffer, 3, 0, 0, 0);
+		vkCmdEndRenderPass(command_buffer);
+	}
+	/* END DYNAMIC RESOLUTION */
+
+
+	/* SCENE */
+	void load_scene() {
+		if (config.mode == RunMode::Replay) {
+			mesh = std::move(replay_capture.mesh); // Read by create_offscreen_target
+			return;
+		}
+
+		// Stand-in for an asset loader: one dense mesh run through the import stage, instanced over a field
+		std::vector<Vertex> source_vertices;
+		std::vector<uint32_t> source_indices;
+		mesh_tools::make_uv_sphere(128, 256, glm::vec3(0.9f, 0.6f, 0.3f), source_vertices, source_indices);
+		mesh = import_mesh(source_vertices, source_indices);
+
+		if (config.scene == SceneType::City) {
+			// Tightly packed blocks either side of an avenue down x = 0, only the nearest ones are visible from the street
+			std::mt19937 rng(7);
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			for (int z = 0; z < CITY_BLOCKS; z++) {
+				for (int x = 0; x < CITY_BLOCKS; x++) {
+					if (x == CITY_BLOCKS / 2) continue;
+					MeshInstance instance{};
+					instance.scale = CITY_SPACING * (0.42f + 0.08f * unit(rng));
+					instance.position = glm::vec3((x - CITY_BLOCKS / 2) * CITY_SPACING, instance.scale * 0.5f, -z * CITY_SPACING);
+					instances.push_back(instance);
+				}
+			}
+
+			float half_width = (CITY_BLOCKS / 2) * CITY_SPACING;
+			light_setup = LightSetup{ LIGHT_COUNT, LIGHT_SEED, glm::vec3(-half_width, 0.5f, -CITY_BLOCKS * CITY_SPACING), glm::vec3(half_width, 4.0f, 2.0f) };
+			scene_lights = generate_lights(light_setup);
+			return;
+		}
+
+		const int grid = 20;
+		const float spacing = 4.0f;
+		for (int z = 0; z < grid; z++) {
+			for (int x = 0; x < grid; x++) {
+				MeshInstance instance{};
+				instance.position = glm::vec3((x - grid / 2) * spacing, 0.0f, -z * spacing);
+				instance.scale = 1.0f;
+				instances.push_back(instance);
+			}
+		}
+
+		// Lights scattered over the same field, just above the spheres
+		light_setup = LightSetup{ LIGHT_COUNT, LIGHT_SEED, glm::vec3(-(grid / 2) * spacing - 2.0f, 0.5f, -(grid - 1) * spacing - 2.0f), glm::vec3((grid / 2) * spacing + 2.0f, 3.0f, 2.0f) };
+		scene_lights = generate_lights(light_setup);
+	}
+
+	// CPU side of the frame: camera, light animation, per instance LOD selection and the resulting draw list
+	void build_frame(FrameInputs& inputs) {
+		const float fov_y = glm::radians(60.0f);
+		glm::vec3 eye(0.0f, 3.0f, 8.0f);
+		glm::vec3 target(0.0f, 0.0f, -20.0f);
+		if (config.scene == SceneType::City) {
+			// Driving down the avenue at street level, so blocks keep coming into view past the corners
+			float travel = std::fmod((float)scene_time * 4.0f, CITY_BLOCKS * CITY_SPACING * 0.5f);
+			eye = glm::vec3(0.0f, 1.5f, 4.0f - travel);
+			target = eye + glm::vec3(0.3f, -0.05f, -1.0f);
+		}
+		glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 proj = glm::perspective(fov_y, swap_chain_extent.width / (float)swap_chain_extent.height, NEAR_PLANE, FAR_PLANE);
+		proj[1][1] *= -1;
+		inputs.camera.view = view;
+		inputs.camera.proj = proj;
+		inputs.camera.position = glm::vec4(eye, 1.0f);
+
+		inputs.light_time = (float)scene_time;
+		animate_lights(scene_lights, inputs.light_time, inputs.lights);
+
+		std::vector<DrawCommand>& draws = inputs.draws;
+		draws.clear();
+		// LODs are picked against the pixels actually rendered, so a lower dynamic resolution scale selects coarser levels
+		update_render_extent();
+		float projection_scale = render_extent.height / (2.0f * std::tan(fov_y * 0.5f));
+
+		MeshStats& stats = mesh_stats[stats_mode()];
+		stats.frames++;
+
+		DrawCommand draw{};
+		draw.data.dequant_offset = glm::vec4(mesh.bounds_min, 0.0f);
+		draw.data.dequant_scale = glm::vec4(mesh.bounds_extent, 0.0f);
+
+		for (const auto& instance : instances) {
+			uint32_t lod = 0;
+			if (lod_enabled) {
+				float distance = glm::length(instance.position + mesh.center * instance.scale - eye);
+				lod = select_lod(mesh, instance.scale, distance, projection_scale, lod_threshold_pixels);
+			}
+			const MeshLod& range = (lod == 0 && !mesh_optimized) ? mesh.unoptimized : mesh.lods[lod];
+
+			glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), instance.position), glm::vec3(instance.scale));
+			draw.data.model = model;
+			draw.bounds = glm::vec4(instance.position + mesh.center * instance.scale, mesh.radius * instance.scale);
+			draw.first_index = range.first_index;
+			draw.index_count = range.index_count;
+			draws.push_back(draw);
+
+			stats.triangles += range.index_count / 3;
+			stats.estimated_vertex_invocations += range.vertex_invocations;
+		}
+	}
+
+	int stats_mode() const {
+		return (lod_enabled ? 2 : 0) + (mesh_optimized ? 1 : 0);
+	}
+
+	void create_query_pools() {
+		// GPU frame time, needs timestamp support on the graphics queue
+		QueueFamilyIndices indices = find_queue_families(physical_device);
+		uint32_t queue_family_count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+		std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families.data());
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+		if (queue_families[indices.graphicsFamily.value()].timestampValidBits != 0) {
+			timestamp_period = properties.limits.timestampPeriod;
+
+			VkQueryPoolCreateInfo timestamp_pool_info{};
+			timestamp_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			timestamp_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			timestamp_pool_info.queryCount = MAX_FRAMES_IN_FLIGHT * TIMESTAMPS_PER_FRAME;
+
+			if (vkCreateQueryPool(device, &timestamp_pool_info, nullptr, &timestamp_query_pool) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to create timestamp query pool!");
+			}
+		}
+
+		VkPhysicalDeviceFeatures supported_features;
+		vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+		if (!supported_features.pipelineStatisticsQuery) return;
+
+		VkQueryPoolCreateInfo query_pool_info{};
+		query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		query_pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		query_pool_info.queryCount = MAX_FRAMES_IN_FLIGHT;
+		query_pool_info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT;
+
+		if (vkCreateQueryPool(device, &query_pool_info, nullptr, &statistics_query_pool) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create query pool!");
+		}
+	}
+
+	// Called once the frame's fence has signalled
+	void collect_timestamps(size_t frame) {
+		if (timestamp_query_pool == VK_NULL_HANDLE || !timestamps_pending[frame]) return;
+
+		uint64_t timestamps[TIMESTAMPS_PER_FRAME] = {};
+		if (vkGetQueryPoolResults(device, timestamp_query_pool, (uint32_t)frame * TIMESTAMPS_PER_FRAME, TIMESTAMPS_PER_FRAME, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			double frame_ms = (timestamps[2] - timestamps[0]) * timestamp_period / 1e6;
+			binning_timer.add_sample((timestamps[1] - timestamps[0]) * timestamp_period / 1e6);
+			gpu_frame_timer.add_sample(frame_ms);
+			culling_gpu_timers[frame_culling[frame] ? 1 : 0].add_sample(frame_ms);
+			if (dynamic_resolution) resolution_controller.add_sample(frame_ms, frame_scale[frame]);
+		}
+		timestamps_pending[frame] = false;
+	}
+
+	// Called once the frame's fence has signalled
+	void collect_statistics(size_t frame) {
+		if (statistics_query_pool == VK_NULL_HANDLE || !statistics_pending[frame]) return;
+
+		// Results come back in bit order: primitives, then vertex shader invocations
+		uint64_t results[2] = {};
+		if (vkGetQueryPoolResults(device, statistics_query_pool, (uint32_t)frame, 1, sizeof(results), results, sizeof(results), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			MeshStats& stats = mesh_stats[statistics_mode[frame]];
+			stats.measured_frames++;
+			stats.measured_primitives += results[0];
+			stats.measured_vertex_invocations += results[1];
+		}
+		statistics_pending[frame] = false;
+	}
+
+	void report_mesh_stats() const {
+		const char* mode_names[] = { "no LOD, unoptimized", "no LOD, optimized", "LOD, unoptimized", "LOD, optimized" };
+
+		std::cout << "mesh: " << mesh.lods.size() << " LODs, " << mesh.vertices.size() << " vertices (" << sizeof(PackedVertex) << " bytes each, " << sizeof(Vertex) << " before quantization)" << std::endl;
+		for (size_t lod = 0; lod < mesh.lods.size(); lod++) {
+			const MeshLod& level = mesh.lods[lod];
+			std::cout << "  LOD " << lod << ": " << level.index_count / 3 << " triangles, error " << level.error << ", ACMR " << (float)level.vertex_invocations / (level.index_count / 3) << std::endl;
+		}
+		std::cout << "  LOD 0 as imported: ACMR " << (float)mesh.unoptimized.vertex_invocations / (mesh.unoptimized.index_count / 3) << std::endl;
+
+		for (int mode = 0; mode < 4; mode++) {
+			const MeshStats& stats = mesh_stats[mode];
+			if (stats.frames == 0) continue;
+			std::cout << mode_names[mode] << ": submitted " << stats.triangles / stats.frames << " triangles/frame, ~" << stats.estimated_vertex_invocations / stats.frames << " vertex invocations/frame (FIFO" << mesh_tools::FIFO_CACHE_SIZE << " estimate, before culling)";
+			if (stats.measured_frames > 0) {
+				std::cout << ", rendered " << stats.measured_primitives / stats.measured_frames << " primitives / " << stats.measured_vertex_invocations / stats.measured_frames << " invocations (measured)";
+			}
+			std::cout << std::endl;
+		}
+	}
+	/* END SCENE */
+
+
+	/* BUFFERS AND IMAGES */
+	void create_vertex_buffer() {
+		create_device_local_buffer(mesh.vertices.data(), sizeof(mesh.vertices[0]) * mesh.vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertex_buffer, vertex_buffer_memory);
+	}
+
+	void create_index_buffer() {
+		create_device_local_buffer(mesh.indices.data(), sizeof(mesh.indices[0]) * mesh.indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, index_buffer, index_buffer_memory);
+	}
+
+	// Uploads through a host visible staging buffer
+	void create_device_local_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& buffer_memory) {
+		VkBuffer staging_buffer;
+		VkDeviceMemory staging_buffer_memory;
+		create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging_buffer, staging_buffer_memory);
+
+		void* mapped;
+		vkMapMemory(device, staging_buffer_memory, 0, size, 0, &mapped);
+		memcpy(mapped, data, (size_t)size);
+		vkUnmapMemory(device, staging_buffer_memory);
+
+		create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, buffer_memory);
+		copy_buffer(staging_buffer, buffer, size);
+
+		vkDestroyBuffer(device, staging_buffer, nullptr);
+		vkFreeMemory(device, staging_buffer_memory, nullptr);
+	}
+
+	void create_mapped_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, AllocatedBuffer& buffer) {
+		create_buffer(size, usage, properties, buffer.buffer, buffer.memory);
+		vkMapMemory(device, buffer.memory, 0, size, 0, &buffer.mapped);
+	}
+
+	void destroy_buffer(AllocatedBuffer& buffer) {
+		if (buffer.mapped) vkUnmapMemory(device, buffer.memory);
+		vkDestroyBuffer(device, buffer.buffer, nullptr);
+		vkFreeMemory(device, buffer.memory, nullptr);
+		buffer = AllocatedBuffer{};
+	}
+
+	void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& buffer_memory) {
+		VkBufferCreateInfo buffer_info{};
+		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_info.size = size;
+		buffer_info.usage = usage;
+		buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create buffer!");
+		}
+
+		VkMemoryRequirements mem_requirements;
+		vkGetBufferMemoryRequirements(device, buffer, &mem_requirements);
+
+		VkMemoryAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = mem_requirements.size;
+		alloc_info.memoryTypeIndex = find_memory_type(mem_requirements.memoryTypeBits, properties);
+
+		if (vkAllocateMemory(device, &alloc_info, nullptr, &buffer_memory) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate buffer memory!");
+		}
+
+		vkBindBufferMemory(device, buffer, buffer_memory, 0);
+	}
+
+	void copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size) {
+		VkCommandBuffer command_buffer = begin_single_time_commands();
+
+		VkBufferCopy copy_region{};
+		copy_region.size = size;
+		vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
+
+		end_single_time_commands(command_buffer);
+	}
+
+	VkCommandBuffer begin_single_time_commands() {
+		VkCommandBufferAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandPool = command_pool;
+		alloc_info.commandBufferCount = 1;
+
+		VkCommandBuffer command_buffer;
+		vkAllocateCommandBuffers(device, &alloc_info, &command_buffer);
+
+		VkCommandBufferBeginInfo begin_info{};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(command_buffer, &begin_info);
+
+		return command_buffer;
+	}
+
+	void end_single_time_commands(VkCommandBuffer command_buffer) {
+		vkEndCommandBuffer(command_buffer);
+
+		VkSubmitInfo submit_info{};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &command_buffer;
+
+		vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+		vkQueueWaitIdle(graphics_queue);
+
+		vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+	}
+
+	void create_image(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkImage& image, VkDeviceMemory& image_memory, uint32_t mip_levels = 1) {
+		VkImageCreateInfo image_info{};
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.extent.width = width;
+		image_info.extent.height = height;
+		image_info.extent.depth = 1;
+		image_info.mipLevels = mip_levels;
+		image_info.arrayLayers = 1;
+		image_info.format = format;
+		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		image_info.usage = usage;
+		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateImage(device, &image_info, nullptr, &image) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create image!");
+		}
+
+		VkMemoryRequirements mem_requirements;
+		vkGetImageMemoryRequirements(device, image, &mem_requirements);
+
+		VkMemoryAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = mem_requirements.size;
+		alloc_info.memoryTypeIndex = find_memory_type(mem_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		if (vkAllocateMemory(device, &alloc_info, nullptr, &image_memory) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate image memory!");
+		}
+
+		vkBindImageMemory(device, image, image_memory, 0);
+	}
+
+	uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties) {
+		VkPhysicalDeviceMemoryProperties mem_properties;
+		vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
+
+		for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++) {
+			if ((type_filter & (1 << i)) && (mem_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+
+		throw std::runtime_error("Failed to find suitable memory type!");
+	}
+	/* END BUFFERS AND IMAGES */
+
+
 	/* SWAP CHAIN */
 	void create_image_views() {
 		swap_chain_image_views.resize(swap_chain_images.size());
 		for (size_t i = 0; i < swap_chain_images.size(); i++) {
-			VkImageViewCreateInfo create_info{};
-			create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-			create_info.image = swap_chain_images[i];
-			create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			create_info.format = swap_chain_image_format;
-			create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-			create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-			create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-			create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-			create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			create_info.subresourceRange.baseMipLevel = 0;
-			create_info.subresourceRange.levelCount = 1;
-			create_info.subresourceRange.baseArrayLayer = 0;
-			create_info.subresourceRange.layerCount = 1;
-
-			if (vkCreateImageView(device, &create_info, nullptr, &swap_chain_image_views[i]) != VK_SUCCESS) {
-				throw std::runtime_error("Failed to create image views!");
-			}
+			swap_chain_image_views[i] = create_image_view(swap_chain_images[i], swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT);
+		}
+	}
+
+	VkImageView create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags, uint32_t base_mip_level = 0, uint32_t level_count = 1) {
+		VkImageViewCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		create_info.image = image;
+		create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		create_info.format = format;
+		create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+		create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+		create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+		create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+		create_info.subresourceRange.aspectMask = aspect_flags;
+		create_info.subresourceRange.baseMipLevel = base_mip_level;
+		create_info.subresourceRange.levelCount = level_count;
+		create_info.subresourceRange.baseArrayLayer = 0;
+		create_info.subresourceRange.layerCount = 1;
+
+		VkImageView image_view;
+		if (vkCreateImageView(device, &create_info, nullptr, &image_view) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create image views!");
 		}
+
+		return image_view;
 	}
 
 	void create_swap_chain() {
@@ -430,6 +2478,29 @@ private:
 		swap_chain_image_format = surface_format.format;
 		swap_chain_extent = extent;
 	}
+
+	// Out of date or suboptimal swapchain (display change, restored from minimized). Only the swapchain side is
+	// rebuilt: the scene target keeps its size, render_extent is clamped to it and the upscale pass stretches
+	// it over whatever the new extent is.
+	void recreate_swap_chain() {
+		// Can race a minimize, a 0x0 swapchain isn't valid so wait for the window to come back
+		while (window_minimized() && !window.should_close()) glfwWaitEvents();
+		if (window.should_close()) return;
+		vkDeviceWaitIdle(device);
+
+		for (auto framebuffer : swap_chain_framebuffers) {
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		}
+		for (auto image_view : swap_chain_image_views) {
+			vkDestroyImageView(device, image_view, nullptr);
+		}
+		vkDestroySwapchainKHR(device, swap_chain, nullptr);
+
+		create_swap_chain();
+		create_image_views();
+		create_swap_chain_framebuffers();
+		images_in_flight.assign(swap_chain_images.size(), VK_NULL_HANDLE);
+	}
 	VkSurfaceFormatKHR choose_swap_surface_format(const std::vector<VkSurfaceFormatKHR>& available_formats) {
 		for (const auto & available_format : available_formats) {
 			if (available_format.format == VK_FORMAT_B8G8R8A8_SRGB && available_format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
@@ -484,8 +2555,14 @@ private:
 				indices.graphicsFamily = i;
 			}
 
+			// Without a surface nothing is presented, the graphics family stands in
 			VkBool32 present_support = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+			if (surface != VK_NULL_HANDLE) {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+			}
+			else {
+				present_support = (queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+			}
 			if (present_support) indices.presentFamily = i;
 
 
@@ -541,7 +2618,14 @@ private:
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
 
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physical_device, &supportedFeatures);
+
 		VkPhysicalDeviceFeatures deviceFeatures{};
+		deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery; // Mesh statistics, optional
+		deviceFeatures.fragmentStoresAndAtomics = VK_TRUE; // Lighting statistics, checked in is_device_suitable
+		deviceFeatures.multiDrawIndirect = VK_TRUE; // GPU culled draws, checked in is_device_suitable
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
 
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -551,8 +2635,9 @@ private:
 
 		createInfo.pEnabledFeatures = &deviceFeatures;
 
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
-		createInfo.ppEnabledExtensionNames = device_extensions.data();
+		auto extensions = required_device_extensions();
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+		createInfo.ppEnabledExtensionNames = extensions.data();
 
 		if (enable_validation_layers) {
 			createInfo.enabledLayerCount = static_cast<uint32_t>(validation_layers.size());
@@ -596,13 +2681,17 @@ private:
 
 		bool extensions_supported = check_device_extension_support(device);
 
-		bool swap_chain_adequate = false;
-		if (extensions_supported) {
+		bool swap_chain_adequate = surface == VK_NULL_HANDLE;
+		if (extensions_supported && !swap_chain_adequate) {
 			SwapChainSupportDetails swap_chain_support = query_swap_chain_support(device);
 			swap_chain_adequate = !swap_chain_support.formats.empty() && !swap_chain_support.present_modes.empty();
 		}
 
-		return indices.is_complete() && extensions_supported && swap_chain_adequate;
+		VkPhysicalDeviceFeatures supported_features;
+		vkGetPhysicalDeviceFeatures(device, &supported_features);
+
+		return indices.is_complete() && extensions_supported && swap_chain_adequate && supported_features.fragmentStoresAndAtomics &&
+			supported_features.multiDrawIndirect && supported_features.drawIndirectFirstInstance;
 	}
 
 	bool check_device_extension_support(VkPhysicalDevice device) {
@@ -612,7 +2701,8 @@ private:
 		std::vector<VkExtensionProperties> available_extensions(extension_count);
 		vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, available_extensions.data());
 
-		std::set<std::string> required_extensions(device_extensions.begin(), device_extensions.end());
+		auto extensions = required_device_extensions();
+		std::set<std::string> required_extensions(extensions.begin(), extensions.end());
 
 		for (const auto & extension : available_extensions) {
 			required_extensions.erase(extension.extensionName);
@@ -624,9 +2714,10 @@ private:
 	void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
 		createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		createInfo.messageSeverity = diagnostics.severity_mask();
 		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-		createInfo.pfnUserCallback = debugCallback;
+		createInfo.pfnUserCallback = Diagnostics::debug_callback;
+		createInfo.pUserData = &diagnostics;
 	}
 
 	void setup_debug_messenger() {
@@ -660,12 +2751,20 @@ private:
 		return true;
 	}
 
-	std::vector<const char *> get_required_extensions() {
-		uint32_t glfw_extension_count = 0;
-		const char ** glfw_extensions;
-		glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+	// Replay has no swapchain, so it needs none of the presentation extensions
+	std::vector<const char*> required_device_extensions() {
+		if (config.mode == RunMode::Replay) return {};
+		return device_extensions;
+	}
 
-		std::vector<const char *> extensions(glfw_extensions, glfw_extensions + glfw_extension_count);
+	std::vector<const char *> get_required_extensions() {
+		std::vector<const char *> extensions;
+		if (config.mode != RunMode::Replay) {
+			uint32_t glfw_extension_count = 0;
+			const char ** glfw_extensions;
+			glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+			extensions.assign(glfw_extensions, glfw_extensions + glfw_extension_count);
+		}
 
 		if (enable_validation_layers) {
 			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -674,17 +2773,6 @@ private:
 		return extensions;
 	}
 
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-		VkDebugUtilsMessageTypeFlagsEXT messageType,
-		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-		void* pUserData) {
-
-		std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
-
-		return VK_FALSE;
-	}
-
 	void create_instance()
 	{
 		if (enable_validation_layers && !check_validation_layers_support()) {
@@ -705,13 +2793,6 @@ private:
 		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 		createInfo.pApplicationInfo = &appInfo;
 
-		// GLFW Extensions
-		uint32_t glfwExtensionCount = 0;
-		const char ** glfwExtensions;
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-		createInfo.enabledExtensionCount = glfwExtensionCount;
-		createInfo.ppEnabledExtensionNames = glfwExtensions;
-
 		// Validation Layer and Extensions
 		if (enable_validation_layers) {
 			createInfo.enabledLayerCount = static_cast<uint32_t>(validation_layers.size());
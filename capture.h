@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+#include "lighting.h"
+#include "culling.h"
+
+/*
+	Frame capture file.
+
+	Everything a frame submitted: the mesh resources, the fixed function state the pipeline was
+	built with, the light setup, and per frame the camera, light animation time and list of DrawCommands. Replaying a capture
+	runs the draws through the current renderer, so a change to the pipeline/render pass/draw
+	loop can be timed against the exact same work.
+
+	Version 3: a DrawCommand is the std430 entry of the draw SSBO (transform, dequantization and
+	world space bounding sphere) plus its index range. Replays upload the captured list and cull.comp
+	turns it into the indirect buffer as it does for live frames, so culling is part of what gets timed.
+
+	Version 4: lights are generated from a seed and animated by time, so the capture stores the
+	LightSetup once and a time per frame instead of every GpuLight every frame (256 KB a frame at
+	4096 lights). read_capture regenerates the per frame light lists before the replay starts.
+
+	Layout (little endian, native struct layout, so captures are not portable between compilers):
+		CaptureHeader
+		CapturedPipelineState
+		mesh: bounds, unoptimized MeshLod, then counted arrays of lods, vertices, indices
+		LightSetup
+		uint32 frame count, then per frame CameraState, float light time and a counted array of DrawCommand
+*/
+
+constexpr uint32_t CAPTURE_MAGIC = 0x43524B56; // "VKRC"
+constexpr uint32_t CAPTURE_VERSION = 4;
+
+struct CaptureHeader {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct CapturedPipelineState {
+	uint32_t extent_width;
+	uint32_t extent_height;
+	uint32_t topology;
+	uint32_t polygon_mode;
+	uint32_t cull_mode;
+	uint32_t front_face;
+	uint32_t vertex_stride;
+
+	bool operator==(const CapturedPipelineState& other) const {
+		return extent_width == other.extent_width && extent_height == other.extent_height && topology == other.topology &&
+			polygon_mode == other.polygon_mode && cull_mode == other.cull_mode && front_face == other.front_face && vertex_stride == other.vertex_stride;
+	}
+};
+
+// Everything one frame consumes. Live frames build one from the scene, captures store a list of them.
+struct FrameInputs {
+	CameraState camera;
+	std::vector<GpuLight> lights; // Not stored, regenerated from the capture's LightSetup and light_time
+	float light_time = 0.0f;
+	std::vector<DrawCommand> draws;
+};
+
+struct FrameCapture {
+	CapturedPipelineState pipeline_state{};
+	Mesh mesh;
+	LightSetup lights{};
+	std::vector<FrameInputs> frames;
+};
+
+namespace capture_io {
+
+	template <typename T>
+	void write_value(std::ofstream& file, const T& value) {
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <typename T>
+	void write_array(std::ofstream& file, const std::vector<T>& values) {
+		write_value(file, (uint32_t)values.size());
+		file.write(reinterpret_cast<const char*>(values.data()), sizeof(T) * values.size());
+	}
+
+	template <typename T>
+	void read_value(std::ifstream& file, T& value) {
+		file.read(reinterpret_cast<char*>(&value), sizeof(T));
+		if (!file) throw std::runtime_error("Truncated capture file!");
+	}
+
+	inline uint64_t remaining_bytes(std::ifstream& file) {
+		std::streampos position = file.tellg();
+		file.seekg(0, std::ios::end);
+		std::streampos end = file.tellg();
+		file.seekg(position);
+		return (uint64_t)(end - position);
+	}
+
+	// Counts are checked against what is left of the file before anything is allocated,
+	// so a corrupt count fails cleanly instead of asking for gigabytes
+	template <typename T>
+	void read_array(std::ifstream& file, std::vector<T>& values) {
+		uint32_t count;
+		read_value(file, count);
+		if ((uint64_t)count * sizeof(T) > remaining_bytes(file)) throw std::runtime_error("Truncated capture file!");
+		values.resize(count);
+		file.read(reinterpret_cast<char*>(values.data()), sizeof(T) * count);
+		if (!file) throw std::runtime_error("Truncated capture file!");
+	}
+
+}
+
+inline void write_capture(const std::string& filename, const FrameCapture& capture) {
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open capture file for writing!");
+	}
+
+	capture_io::write_value(file, CaptureHeader{ CAPTURE_MAGIC, CAPTURE_VERSION });
+	capture_io::write_value(file, capture.pipeline_state);
+
+	const Mesh& mesh = capture.mesh;
+	capture_io::write_value(file, mesh.bounds_min);
+	capture_io::write_value(file, mesh.bounds_extent);
+	capture_io::write_value(file, mesh.center);
+	capture_io::write_value(file, mesh.radius);
+	capture_io::write_value(file, mesh.unoptimized);
+	capture_io::write_array(file, mesh.lods);
+	capture_io::write_array(file, mesh.vertices);
+	capture_io::write_array(file, mesh.indices);
+	capture_io::write_value(file, capture.lights);
+
+	capture_io::write_value(file, (uint32_t)capture.frames.size());
+	for (const auto& frame : capture.frames) {
+		capture_io::write_value(file, frame.camera);
+		capture_io::write_value(file, frame.light_time);
+		capture_io::write_array(file, frame.draws);
+	}
+
+	if (!file) {
+		throw std::runtime_error("Failed to write capture file!");
+	}
+}
+
+inline FrameCapture read_capture(const std::string& filename) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open capture file!");
+	}
+
+	CaptureHeader header;
+	capture_io::read_value(file, header);
+	if (header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+		throw std::runtime_error("Unsupported capture file!");
+	}
+
+	FrameCapture capture;
+	capture_io::read_value(file, capture.pipeline_state);
+
+	Mesh& mesh = capture.mesh;
+	capture_io::read_value(file, mesh.bounds_min);
+	capture_io::read_value(file, mesh.bounds_extent);
+	capture_io::read_value(file, mesh.center);
+	capture_io::read_value(file, mesh.radius);
+	capture_io::read_value(file, mesh.unoptimized);
+	capture_io::read_array(file, mesh.lods);
+	capture_io::read_array(file, mesh.vertices);
+	capture_io::read_array(file, mesh.indices);
+	for (uint32_t index : mesh.indices) {
+		if (index >= mesh.vertices.size()) {
+			throw std::runtime_error("Capture index is out of range of the captured vertex buffer!");
+		}
+	}
+
+	capture_io::read_value(file, capture.lights);
+	if (capture.lights.count > MAX_LIGHTS) {
+		throw std::runtime_error("Capture has more lights than the renderer supports!");
+	}
+
+	// Smallest possible frame is a camera, a light time and an empty array
+	uint32_t frame_count;
+	capture_io::read_value(file, frame_count);
+	if ((uint64_t)frame_count * (sizeof(CameraState) + sizeof(float) + sizeof(uint32_t)) > capture_io::remaining_bytes(file)) {
+		throw std::runtime_error("Truncated capture file!");
+	}
+	std::vector<SceneLight> scene_lights = generate_lights(capture.lights);
+	capture.frames.resize(frame_count);
+	for (auto& frame : capture.frames) {
+		capture_io::read_value(file, frame.camera);
+		capture_io::read_value(file, frame.light_time);
+		capture_io::read_array(file, frame.draws);
+		animate_lights(scene_lights, frame.light_time, frame.lights);
+		if (frame.draws.size() > MAX_SCENE_DRAWS) {
+			throw std::runtime_error("Capture has more draws than the renderer supports!");
+		}
+		for (const auto& draw : frame.draws) {
+			if ((uint64_t)draw.first_index + draw.index_count > mesh.indices.size()) {
+				throw std::runtime_error("Capture draw is out of range of the captured index buffer!");
+			}
+		}
+	}
+
+	return capture;
+}
@@ -1,3 +1,31 @@
-F:/Vulkan/1.2.170.0/Bin/glslc.exe triangle.vert -o shaderout/vert.spv
-F:/Vulkan/1.2.170.0/Bin/glslc.exe triangle.frag -o shaderout/frag.spv
-pause
\ No newline at end of file
+@echo off
+rem Compiles shaders/ into shaderout/. Runs as the project's pre-build step with "nopause".
+setlocal
+cd /d "%~dp0"
+
+if not defined VULKAN_SDK (
+	echo VULKAN_SDK is not set. Install the Vulkan SDK, or set VULKAN_SDK to its root, so glslc can be found.
+	goto failed
+)
+set "GLSLC=%VULKAN_SDK%/Bin/glslc.exe"
+if not exist "%GLSLC%" (
+	echo glslc not found at %GLSLC%
+	goto failed
+)
+if not exist shaderout mkdir shaderout
+
+"%GLSLC%" shaders/mesh.vert -o shaderout/mesh_vert.spv || goto failed
+"%GLSLC%" shaders/mesh.frag -o shaderout/mesh_frag.spv || goto failed
+"%GLSLC%" shaders/cluster_lights.comp -o shaderout/cluster_comp.spv || goto failed
+"%GLSLC%" shaders/cull.comp -o shaderout/cull_comp.spv || goto failed
+"%GLSLC%" shaders/depth_reduce.comp -o shaderout/depth_reduce_comp.spv || goto failed
+"%GLSLC%" shaders/fullscreen.vert -o shaderout/fullscreen_vert.spv || goto failed
+"%GLSLC%" shaders/upscale.frag -o shaderout/upscale_frag.spv || goto failed
+
+if not "%1"=="nopause" pause
+exit /b 0
+
+:failed
+echo Shader compilation failed, shaderout/ is incomplete
+if not "%1"=="nopause" pause
+exit /b 1
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+	Two phase occlusion culling against a hierarchical depth (Hi-Z) pyramid.
+
+	Every draw carries a world space bounding sphere (DrawCommand::bounds). shaders/cull.comp
+	writes one VkDrawIndexedIndirectCommand per draw, with instanceCount 0 for culled draws,
+	so culled objects never reach the vertex stage.
+
+		early phase: draws that were visible last frame and pass the frustum test are drawn
+		depth pyramid: shaders/depth_reduce.comp reduces that depth to a max depth mip chain
+		late phase: every draw is frustum and occlusion tested against the pyramid, the ones
+			that are visible but weren't drawn early (newly visible) are drawn, and the result
+			becomes next frame's visibility
+
+	Visibility is kept per draw index, so the scene has to submit its objects in the same order
+	every frame. With culling off there is no late phase and it is reset to all visible instead.
+*/
+
+constexpr uint32_t MAX_SCENE_DRAWS = 4096;
+constexpr uint32_t MAX_DEPTH_PYRAMID_LEVELS = 16;
+constexpr uint32_t CULL_WORKGROUP_SIZE = 64;
+constexpr uint32_t DEPTH_REDUCE_WORKGROUP_SIZE = 8;
+
+enum CullPhase : uint32_t {
+	CULL_PHASE_EARLY = 0,
+	CULL_PHASE_LATE = 1
+};
+
+struct CullPushConstants {
+	uint32_t phase;
+	uint32_t draw_count;
+	uint32_t culling_enabled; // 0 draws everything in the early phase
+	uint32_t command_offset; // Early and late commands live in separate halves of the indirect buffer
+};
+
+struct DepthReducePushConstants {
+	int32_t source_width;
+	int32_t source_height;
+	int32_t destination_width;
+	int32_t destination_height;
+};
+
+// Written by the cull shader, read back for reporting
+struct CullStats {
+	uint32_t draws;
+	uint32_t drawn_early;
+	uint32_t drawn_late;
+	uint32_t frustum_culled;
+	uint32_t occlusion_culled;
+};
+
+// The pyramid's top level is the largest power of two that fits in the depth buffer,
+// so every level halves exactly and each texel covers a whole number of texels below it
+inline uint32_t previous_pow2(uint32_t value) {
+	uint32_t result = 1;
+	while (result * 2 <= value) result *= 2;
+	return result;
+}
+
+inline uint32_t depth_pyramid_levels(uint32_t width, uint32_t height) {
+	uint32_t levels = 1;
+	while ((width | height) >> levels) levels++;
+	return levels;
+}
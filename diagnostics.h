@@ -0,0 +1,525 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Validation layer diagnostics.
+
+	The debug messenger callback runs on whatever thread the driver/layer happens to be on,
+	so it must not block. Messages are copied into a fixed size lock-free queue and a
+	background thread drains it, deduplicates by message ID and prints. PERFORMANCE
+	messages are additionally rolled up into a one line summary per frame. The callback only
+	pushes and raises a flag; the render thread wakes the worker from end_frame when the flag
+	is set, and the worker polls quickly while messages keep arriving.
+
+	Define SYNCHRONOUS_VALIDATION_LOG to get the old behaviour (every message straight to
+	std::cerr from the callback) for comparing frame times. Per ID counts are kept in both modes.
+*/
+
+// Bounded multi-producer/multi-consumer ring (Dmitry Vyukov's design). Never allocates after construction.
+template <typename T, size_t Capacity>
+class MessageQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+public:
+	MessageQueue() {
+		for (size_t i = 0; i < Capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool try_push(const T& value) {
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = cells[pos & (Capacity - 1)];
+			size_t seq = cell.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.value = value;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false; // Full
+			}
+			else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool try_pop(T& value) {
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = cells[pos & (Capacity - 1)];
+			size_t seq = cell.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (diff == 0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					value = cell.value;
+					cell.sequence.store(pos + Capacity, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false; // Empty
+			}
+			else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	// Keep producer and consumer indices on separate cache lines
+	alignas(64) Cell cells[Capacity];
+	alignas(64) std::atomic<size_t> enqueue_pos{ 0 };
+	alignas(64) std::atomic<size_t> dequeue_pos{ 0 };
+};
+
+// Occurrence count per message key, bumped by the producers before anything can be dropped.
+// Fixed size open addressing table, lock-free; keys that don't fit go to an overflow total.
+class MessageCounter {
+public:
+	static constexpr size_t SLOTS = 512;
+
+	void add(uint64_t key) {
+		size_t start = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+		for (size_t probe = 0; probe < SLOTS; probe++) {
+			Slot& slot = slots[(start + probe) & (SLOTS - 1)];
+			uint64_t current = slot.key.load(std::memory_order_acquire);
+			if (current == 0 && slot.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) current = key;
+			if (current == key) {
+				slot.count.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+		overflow.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// (key, count) of every slot in use, for the summary once producers are done
+	std::vector<std::pair<uint64_t, uint64_t>> snapshot() const {
+		std::vector<std::pair<uint64_t, uint64_t>> counts;
+		for (const Slot& slot : slots) {
+			uint64_t key = slot.key.load(std::memory_order_acquire);
+			if (key != 0) counts.emplace_back(key, slot.count.load(std::memory_order_relaxed));
+		}
+		return counts;
+	}
+
+	uint64_t overflowed() const { return overflow.load(std::memory_order_relaxed); }
+
+private:
+	struct Slot {
+		std::atomic<uint64_t> key{ 0 };
+		std::atomic<uint64_t> count{ 0 };
+	};
+
+	Slot slots[SLOTS];
+	std::atomic<uint64_t> overflow{ 0 };
+};
+
+struct DiagnosticMessage {
+	static constexpr size_t MAX_TEXT = 512;
+
+	uint64_t key; // Dedup key, see Diagnostics::message_key
+	int32_t message_id;
+	uint64_t frame;
+	VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+	VkDebugUtilsMessageTypeFlagsEXT type;
+	char text[MAX_TEXT];
+};
+
+class Diagnostics {
+public:
+	Diagnostics() {
+		startup_severity = severity_from_env();
+		min_severity.store(startup_severity, std::memory_order_relaxed);
+#ifndef SYNCHRONOUS_VALIDATION_LOG
+		queue = std::make_unique<MessageQueue<DiagnosticMessage, QUEUE_CAPACITY>>();
+		worker = std::thread(&Diagnostics::drain_loop, this);
+#endif
+	}
+	~Diagnostics() {
+		running.store(false, std::memory_order_release);
+		if (worker.joinable()) {
+			wake_worker();
+			worker.join();
+		}
+		print_summary();
+	}
+
+	// Severities the messenger subscribes to. Anything below the startup level is never generated by the layers,
+	// which is where most of the cost of VERBOSE logging actually is.
+	VkDebugUtilsMessageSeverityFlagsEXT severity_mask() const {
+		VkDebugUtilsMessageSeverityFlagsEXT mask = 0;
+		VkDebugUtilsMessageSeverityFlagBitsEXT severities[] = {
+			VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT,
+			VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
+			VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT,
+			VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT
+		};
+		for (auto severity : severities) {
+			if (severity >= startup_severity) mask |= severity;
+		}
+		return mask;
+	}
+
+	// Runtime filter. Clamped to the startup level: the messenger never subscribed to anything below it.
+	void set_min_severity(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+		min_severity.store(std::max(severity, startup_severity), std::memory_order_relaxed);
+	}
+
+	// Steps the filter up one level, wrapping from error back to the startup level
+	VkDebugUtilsMessageSeverityFlagBitsEXT cycle_min_severity() {
+		VkDebugUtilsMessageSeverityFlagBitsEXT current = min_severity.load(std::memory_order_relaxed);
+		set_min_severity(current >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT ? startup_severity
+			: (VkDebugUtilsMessageSeverityFlagBitsEXT)(current << 4)); // Severity bits are 4 apart
+		return min_severity.load(std::memory_order_relaxed);
+	}
+
+	static const char* severity_name(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+		switch (severity) {
+		case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT: return "verbose";
+		case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT: return "info";
+		case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT: return "warning";
+		case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT: return "error";
+		default: return "unknown";
+		}
+	}
+
+	// Called once per frame from the main loop, closes the current performance summary window.
+	// Also where the worker gets woken for new messages, so the callback itself never touches a lock.
+	void end_frame() {
+		frame.fetch_add(1, std::memory_order_release);
+		if (pending.load(std::memory_order_acquire)) wake_worker();
+	}
+
+	void submit(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT* data) {
+		if (severity < min_severity.load(std::memory_order_relaxed)) return;
+		received.fetch_add(1, std::memory_order_relaxed);
+
+#ifdef SYNCHRONOUS_VALIDATION_LOG
+		counter.add(message_key(data->messageIdNumber, data->pMessage ? data->pMessage : ""));
+		std::cerr << "validation layer: " << data->pMessage << std::endl;
+#else
+		DiagnosticMessage message;
+		message.message_id = data->messageIdNumber;
+		message.frame = frame.load(std::memory_order_acquire);
+		message.severity = severity;
+		message.type = type;
+		strncpy(message.text, data->pMessage ? data->pMessage : "", DiagnosticMessage::MAX_TEXT - 1);
+		message.text[DiagnosticMessage::MAX_TEXT - 1] = '\0';
+		message.key = message_key(message.message_id, message.text);
+
+		// Counted before queueing so the summary stays right per ID even when the queue is full
+		counter.add(message.key);
+		if (!queue->try_push(message)) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		pending.store(true, std::memory_order_release);
+#endif
+	}
+
+	static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+		VkDebugUtilsMessageTypeFlagsEXT messageType,
+		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+		void* pUserData) {
+
+		static_cast<Diagnostics*>(pUserData)->submit(messageSeverity, messageType, pCallbackData);
+
+		return VK_FALSE;
+	}
+
+private:
+	struct Record {
+		uint64_t count = 0;
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+		VkDebugUtilsMessageTypeFlagsEXT type;
+		std::string text;
+	};
+
+	static constexpr size_t QUEUE_CAPACITY = 1024;
+
+	// Over half a megabyte, kept off the stack of whoever owns the Diagnostics. Not allocated in synchronous mode.
+	std::unique_ptr<MessageQueue<DiagnosticMessage, QUEUE_CAPACITY>> queue;
+	MessageCounter counter;
+	std::thread worker;
+	std::atomic<bool> running{ true };
+	std::atomic<uint64_t> frame{ 0 };
+	VkDebugUtilsMessageSeverityFlagBitsEXT startup_severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+	std::atomic<VkDebugUtilsMessageSeverityFlagBitsEXT> min_severity{ VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT };
+	std::atomic<uint64_t> received{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+
+	// Worker wake up: end_frame notifies when the callback has flagged new messages. While messages keep coming
+	// the worker polls at ACTIVE_WAIT_MS so a burst inside one frame doesn't fill the queue, otherwise it sleeps
+	// IDLE_WAIT_MS at a time to close performance frames.
+	static constexpr int ACTIVE_WAIT_MS = 2;
+	static constexpr int IDLE_WAIT_MS = 64;
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	std::atomic<bool> pending{ false };
+
+	// Owned by the worker thread (or the destructor once it has joined)
+	std::unordered_map<uint64_t, Record> records;
+	std::unordered_map<uint64_t, uint64_t> frame_performance;
+	uint64_t performance_frame = 0;
+
+	// Render thread only. Taking the mutex, even empty, orders the notify after the worker's predicate check.
+	void wake_worker() {
+		{ std::lock_guard<std::mutex> lock(wake_mutex); }
+		wake.notify_one();
+	}
+
+	void drain_loop() {
+		DiagnosticMessage message;
+		for (;;) {
+			// Cleared before draining, anything pushed from here on is flagged for the next end_frame
+			pending.store(false, std::memory_order_release);
+			bool drained_any = false;
+			while (queue->try_pop(message)) {
+				handle(message);
+				drained_any = true;
+			}
+			flush_performance(frame.load(std::memory_order_acquire));
+
+			if (!running.load(std::memory_order_acquire)) {
+				// Last pass to pick up anything pushed while shutting down
+				while (queue->try_pop(message)) handle(message);
+				flush_performance(UINT64_MAX);
+				break;
+			}
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			wake.wait_for(lock, std::chrono::milliseconds(drained_any ? ACTIVE_WAIT_MS : IDLE_WAIT_MS), [this] {
+				return pending.load(std::memory_order_acquire) || !running.load(std::memory_order_acquire);
+			});
+		}
+	}
+
+	// Loader/general messages tend to share ID 0, fall back to the text for those. Only the part a queued
+	// message keeps is hashed, so synchronous and queued modes agree on keys.
+	static uint64_t message_key(int32_t message_id, const char* text) {
+		if (message_id != 0) return (uint64_t)(uint32_t)message_id;
+		uint64_t hash = std::hash<std::string_view>{}(std::string_view(text).substr(0, DiagnosticMessage::MAX_TEXT - 1));
+		return hash != 0 ? hash : 1; // 0 is the counter's empty slot
+	}
+
+	void handle(const DiagnosticMessage& message) {
+		uint64_t key = message.key;
+
+		Record& record = records[key];
+		if (record.count++ == 0) {
+			record.severity = message.severity;
+			record.type = message.type;
+			record.text = message.text;
+			std::cerr << "validation layer [" << severity_name(message.severity) << "]: " << message.text << '\n';
+		}
+
+		if (message.type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) {
+			if (message.frame > performance_frame) flush_performance(message.frame);
+			frame_performance[key]++;
+		}
+	}
+
+	// Prints the performance summary for performance_frame once the main loop has moved past it
+	void flush_performance(uint64_t current_frame) {
+		if (current_frame == performance_frame) return;
+		if (!frame_performance.empty()) {
+			uint64_t total = 0;
+			for (const auto& entry : frame_performance) total += entry.second;
+
+			std::cerr << "performance: frame " << performance_frame << ", " << total << " warnings (" << frame_performance.size() << " unique)";
+			for (const auto& entry : frame_performance) {
+				std::cerr << " [0x" << std::hex << entry.first << std::dec << " x" << entry.second << "]";
+			}
+			std::cerr << '\n';
+			frame_performance.clear();
+		}
+		performance_frame = current_frame;
+	}
+
+	// Counts come from the producer side counter, so IDs whose copies were dropped are still reported
+	void print_summary() {
+		std::vector<std::pair<uint64_t, uint64_t>> counts = counter.snapshot();
+		std::sort(counts.begin(), counts.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+		std::cerr << "diagnostics: " << received.load() << " messages, " << counts.size() << " unique, " << dropped.load() << " dropped";
+		if (counter.overflowed() > 0) std::cerr << ", " << counter.overflowed() << " past the ID table";
+		std::cerr << '\n';
+
+		for (const auto& entry : counts) {
+			if (entry.second <= 1) break;
+			auto record = records.find(entry.first);
+			if (record != records.end()) {
+				std::cerr << "  x" << entry.second << " [" << severity_name(record->second.severity) << "] " << record->second.text.substr(0, 120) << '\n';
+			}
+			else {
+				// Synchronous mode printed every copy as it arrived and keeps no text
+				std::cerr << "  x" << entry.second << " [0x" << std::hex << entry.first << std::dec << "] " << (queue ? "every copy dropped" : "printed inline") << '\n';
+			}
+		}
+	}
+
+	// VK_RENDERER_LOG_LEVEL=verbose|info|warning|error, defaults to warning
+	static VkDebugUtilsMessageSeverityFlagBitsEXT severity_from_env() {
+		const char* level = std::getenv("VK_RENDERER_LOG_LEVEL");
+		if (level == nullptr) return VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+		if (strcmp(level, "verbose") == 0) return VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+		if (strcmp(level, "info") == 0) return VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+		if (strcmp(level, "error") == 0) return VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		return VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+	}
+};
+
+// Frame time bookkeeping for comparing logging/validation overhead and for capture replays.
+// Count, average and min cover every sample; median and p99 come from the most recent WINDOW samples
+// so a long interactive session doesn't grow memory without bound.
+class FrameTimer {
+public:
+	static constexpr size_t WINDOW = 4096;
+
+	void begin_frame() {
+		frame_start = std::chrono::high_resolution_clock::now();
+	}
+	void end_frame() {
+		auto frame_end = std::chrono::high_resolution_clock::now();
+		add_sample(std::chrono::duration<double, std::milli>(frame_end - frame_start).count());
+	}
+
+	// For times measured elsewhere, e.g. GPU timestamps
+	void add_sample(double milliseconds) {
+		if (frame_times.size() < WINDOW) frame_times.push_back(milliseconds);
+		else frame_times[samples % WINDOW] = milliseconds;
+		samples++;
+		total += milliseconds;
+		lowest = std::min(lowest, milliseconds);
+	}
+
+	void reset() {
+		frame_times.clear();
+		samples = 0;
+		total = 0.0;
+		lowest = DBL_MAX;
+	}
+
+	size_t frame_count() const { return samples; }
+
+	// p in [0, 1], over the recent window
+	double percentile(double p) const {
+		if (frame_times.empty()) return 0.0;
+		std::vector<double> sorted = frame_times;
+		std::sort(sorted.begin(), sorted.end());
+		size_t index = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+		return sorted[index];
+	}
+
+	double average() const {
+		if (samples == 0) return 0.0;
+		return total / samples;
+	}
+
+	void report(const char* label) const {
+		std::cout << label << ": " << frame_count() << " frames, avg " << average() << " ms, min " << (samples > 0 ? lowest : 0.0)
+			<< " ms, median " << percentile(0.5) << " ms, p99 " << percentile(0.99) << " ms";
+		if (samples > WINDOW) std::cout << " (median/p99 over last " << WINDOW << ")";
+		std::cout << std::endl;
+	}
+
+private:
+	std::chrono::high_resolution_clock::time_point frame_start;
+	std::vector<double> frame_times; // Ring once full, oldest overwritten first
+	size_t samples = 0;
+	double total = 0.0;
+	double lowest = DBL_MAX;
+};
+
+// CPU time used by the whole process so far, all threads
+inline double process_cpu_seconds() {
+#ifdef _WIN32
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) return 0.0;
+	ULARGE_INTEGER kernel, user;
+	kernel.LowPart = kernel_time.dwLowDateTime;
+	kernel.HighPart = kernel_time.dwHighDateTime;
+	user.LowPart = user_time.dwLowDateTime;
+	user.HighPart = user_time.dwHighDateTime;
+	return (kernel.QuadPart + user.QuadPart) * 1e-7; // 100 ns units
+#else
+	return (double)std::clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// CPU utilization and frame rate of the main loop, split into iterations that rendered and ones that idled
+class ActivityMeter {
+public:
+	void begin_iteration() {
+		iteration_start = std::chrono::steady_clock::now();
+		cpu_start = process_cpu_seconds();
+	}
+	// Charges the time blocked waiting for events to idle, even when the wait ends in a render
+	void end_wait() {
+		end_iteration(false, 0);
+		begin_iteration();
+	}
+	void end_iteration(bool active, uint32_t frames_presented) {
+		Totals& state = totals[active ? 1 : 0];
+		state.wall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - iteration_start).count();
+		state.cpu_seconds += process_cpu_seconds() - cpu_start;
+		state.frames += frames_presented;
+	}
+
+	void report(const char* label) const {
+		const char* names[2] = { "idle", "active" };
+		for (int i = 0; i < 2; i++) {
+			const Totals& state = totals[i];
+			if (state.wall_seconds <= 0.0) continue;
+			std::cout << label << " " << names[i] << ": " << state.wall_seconds << " s, cpu " << 100.0 * state.cpu_seconds / state.wall_seconds
+				<< "% of a core, " << state.frames * 60.0 / state.wall_seconds << " frames/min" << std::endl;
+		}
+	}
+
+private:
+	struct Totals {
+		double wall_seconds = 0.0;
+		double cpu_seconds = 0.0;
+		uint64_t frames = 0;
+	};
+
+	std::chrono::steady_clock::time_point iteration_start;
+	double cpu_start = 0.0;
+	Totals totals[2]; // Idle, active
+};
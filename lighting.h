@@ -0,0 +1,148 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/*
+	Clustered forward lighting.
+
+	The view frustum is cut into CLUSTER_X x CLUSTER_Y screen tiles and CLUSTER_Z exponential
+	depth slices. Every frame shaders/cluster_lights.comp bins the lights into clusters (one
+	workgroup per cluster) and writes a compact list of light indices per cluster. The forward
+	fragment shader looks up its cluster and only shades the lights in that list.
+
+	Structures here are shared with the shaders, keep them in sync with the GLSL declarations.
+*/
+
+constexpr uint32_t CLUSTER_X = 16;
+constexpr uint32_t CLUSTER_Y = 9;
+constexpr uint32_t CLUSTER_Z = 24;
+constexpr uint32_t CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+constexpr uint32_t CLUSTER_AVERAGE_LIGHTS = 64; // Sizes the shared light index list, overflow is counted and dropped
+constexpr uint32_t LIGHT_INDEX_CAPACITY = CLUSTER_COUNT * CLUSTER_AVERAGE_LIGHTS;
+constexpr uint32_t MAX_LIGHTS = 8192;
+
+// Depth range the slices are spread over, fragments in front of CLUSTER_NEAR land in the first slice
+constexpr float CLUSTER_NEAR = 0.5f;
+
+enum LightType : uint32_t {
+	LIGHT_POINT = 0,
+	LIGHT_SPOT = 1
+};
+
+// std430, 64 bytes
+struct GpuLight {
+	glm::vec4 position_range; // xyz world position, w range
+	glm::vec4 color_intensity; // rgb color, w intensity
+	glm::vec4 direction_cos_outer; // xyz spot direction, w cos(outer angle)
+	glm::vec4 params; // x cos(inner angle), y LightType
+};
+
+// std140, one per frame in flight
+struct FrameUniforms {
+	glm::mat4 view;
+	glm::mat4 proj;
+	glm::mat4 view_proj;
+	glm::mat4 inverse_proj;
+	glm::vec4 camera_position;
+	glm::vec4 screen_size; // xy size, zw 1 / size
+	glm::vec4 cluster_params; // x cluster near, y far, z slice scale, w slice bias
+	glm::uvec4 cluster_grid; // xyz cluster counts, w light count
+	glm::uvec4 flags; // x collect stats, y brute force, z light index capacity
+};
+
+// Written by the binning pass and the fragment shader, read back for reporting
+struct ClusterStats {
+	uint32_t index_count;
+	uint32_t overflow;
+	uint32_t fragments[2]; // Low, high word, the shader carries between them
+	uint32_t lights_evaluated[2];
+};
+
+inline uint64_t stats_counter(const uint32_t words[2]) {
+	return (uint64_t)words[1] << 32 | words[0];
+}
+
+struct CameraState {
+	glm::mat4 view;
+	glm::mat4 proj;
+	glm::vec4 position;
+};
+
+// slice = log(view_depth) * scale - bias, so that slice 0 starts at near and CLUSTER_Z ends at far
+inline glm::vec4 cluster_slice_params(float near_plane, float far_plane) {
+	float log_ratio = std::log(far_plane / near_plane);
+	float scale = CLUSTER_Z / log_ratio;
+	float bias = CLUSTER_Z * std::log(near_plane) / log_ratio;
+	return glm::vec4(near_plane, far_plane, scale, bias);
+}
+
+// Lights orbit an anchor so the binning has something to do every frame
+struct SceneLight {
+	glm::vec3 anchor;
+	float orbit_radius;
+	float orbit_speed;
+	float phase;
+	GpuLight light;
+};
+
+// Everything generate_lights takes. Captures store this instead of the light list, replays regenerate the lights from it.
+struct LightSetup {
+	uint32_t count;
+	uint32_t seed;
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+};
+
+inline std::vector<SceneLight> generate_lights(uint32_t count, glm::vec3 bounds_min, glm::vec3 bounds_max, uint32_t seed = 1337) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<SceneLight> scene_lights(count);
+	for (auto& scene_light : scene_lights) {
+		scene_light.anchor = glm::vec3(
+			bounds_min.x + unit(rng) * (bounds_max.x - bounds_min.x),
+			bounds_min.y + unit(rng) * (bounds_max.y - bounds_min.y),
+			bounds_min.z + unit(rng) * (bounds_max.z - bounds_min.z));
+		scene_light.orbit_radius = 0.5f + unit(rng) * 2.0f;
+		scene_light.orbit_speed = 0.2f + unit(rng) * 0.8f;
+		scene_light.phase = unit(rng) * 6.2831853f;
+
+		GpuLight& light = scene_light.light;
+		bool spot = unit(rng) < 0.25f;
+		light.position_range = glm::vec4(scene_light.anchor, 1.5f + unit(rng) * 3.0f);
+		light.color_intensity = glm::vec4(0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng), 1.0f + unit(rng));
+		if (spot) {
+			light.position_range.w *= 2.0f;
+			light.direction_cos_outer = glm::vec4(glm::normalize(glm::vec3(unit(rng) - 0.5f, -1.0f, unit(rng) - 0.5f)), std::cos(glm::radians(35.0f)));
+			light.params = glm::vec4(std::cos(glm::radians(25.0f)), (float)LIGHT_SPOT, 0.0f, 0.0f);
+		}
+		else {
+			light.direction_cos_outer = glm::vec4(0.0f, -1.0f, 0.0f, -1.0f);
+			light.params = glm::vec4(-1.0f, (float)LIGHT_POINT, 0.0f, 0.0f);
+		}
+	}
+	return scene_lights;
+}
+
+inline std::vector<SceneLight> generate_lights(const LightSetup& setup) {
+	return generate_lights(setup.count, setup.bounds_min, setup.bounds_max, setup.seed);
+}
+
+inline void animate_lights(const std::vector<SceneLight>& scene_lights, float time, std::vector<GpuLight>& lights) {
+	lights.resize(scene_lights.size());
+	for (size_t i = 0; i < scene_lights.size(); i++) {
+		const SceneLight& scene_light = scene_lights[i];
+		float angle = scene_light.phase + time * scene_light.orbit_speed;
+		lights[i] = scene_light.light;
+		lights[i].position_range = glm::vec4(
+			scene_light.anchor + glm::vec3(std::cos(angle), 0.0f, std::sin(angle)) * scene_light.orbit_radius,
+			scene_light.light.position_range.w);
+	}
+}
@@ -3,12 +3,70 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <cctype>
 #include <cstdlib>
+#include <string>
 
 #include "application.h"
 
-int main() {
-	Application vk_app{};
+static void print_usage() {
+	std::cerr << "Usage: VulkanRender [--scene field|city] [--capture <file> [frames]] [--replay <file> [iterations]]\n"
+		"                    [--resolution <min scale> <max scale>] [--gpu-budget <ms>] [--sharpness <0-1>] [--on-demand]\n"
+		"--replay renders offscreen at the captured resolution, without a window or display" << std::endl;
+}
+
+int main(int argc, char ** argv) {
+	RunConfig config{};
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		bool has_count = i + 2 < argc && std::isdigit((unsigned char)argv[i + 2][0]);
+		if (arg == "--capture" && has_value) {
+			config.capture_path = argv[++i];
+			if (has_count) config.capture_frames = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--scene" && has_value) {
+			std::string scene = argv[++i];
+			if (scene == "city") config.scene = SceneType::City;
+			else if (scene == "field") config.scene = SceneType::Field;
+			else {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--resolution" && i + 2 < argc) {
+			config.resolution.min_scale = std::strtof(argv[++i], nullptr);
+			config.resolution.max_scale = std::strtof(argv[++i], nullptr);
+			if (!(config.resolution.min_scale >= 0.25f && config.resolution.min_scale <= config.resolution.max_scale && config.resolution.max_scale <= 2.0f)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--gpu-budget" && has_value) {
+			config.resolution.gpu_budget_ms = std::strtof(argv[++i], nullptr);
+			if (!(config.resolution.gpu_budget_ms > 0.0f)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--sharpness" && has_value) {
+			config.resolution.sharpness = std::min(std::max(std::strtof(argv[++i], nullptr), 0.0f), 1.0f);
+		}
+		else if (arg == "--on-demand") {
+			config.on_demand = true;
+		}
+		else if (arg == "--replay" && has_value) {
+			config.mode = RunMode::Replay;
+			config.replay_path = argv[++i];
+			if (has_count) config.replay_iterations = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	Application vk_app{ config };
 
 	try 
 	{
@@ -0,0 +1,522 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Mesh import stage.
+
+	import_mesh() takes plain float vertices/indices (whatever a loader produced) and
+	turns them into what the renderer draws:
+		1. A LOD chain built by vertex clustering, each level roughly half the triangles of the last
+		2. Per LOD index reordering for post-transform vertex cache locality (Forsyth)
+		3. Vertex reordering by first use for vertex fetch locality
+		4. Attribute quantization, 36 byte Vertex -> 16 byte PackedVertex
+
+	At runtime select_lod() picks a level per instance from its projected screen space error.
+*/
+
+// Import format
+struct Vertex {
+	glm::vec3 pos;
+	glm::vec3 normal;
+	glm::vec3 color;
+};
+
+// GPU format. Positions are unorm16 relative to the mesh bounds and get rebuilt in the vertex shader.
+struct PackedVertex {
+	uint16_t pos[4];
+	int8_t normal[4];
+	uint8_t color[4];
+
+	static VkVertexInputBindingDescription get_binding_description() {
+		VkVertexInputBindingDescription binding_description{};
+		binding_description.binding = 0;
+		binding_description.stride = sizeof(PackedVertex);
+		binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return binding_description;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 3> get_attribute_descriptions() {
+		std::array<VkVertexInputAttributeDescription, 3> attribute_descriptions{};
+		attribute_descriptions[0].binding = 0;
+		attribute_descriptions[0].location = 0;
+		attribute_descriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+		attribute_descriptions[0].offset = offsetof(PackedVertex, pos);
+
+		attribute_descriptions[1].binding = 0;
+		attribute_descriptions[1].location = 1;
+		attribute_descriptions[1].format = VK_FORMAT_R8G8B8A8_SNORM;
+		attribute_descriptions[1].offset = offsetof(PackedVertex, normal);
+
+		attribute_descriptions[2].binding = 0;
+		attribute_descriptions[2].location = 2;
+		attribute_descriptions[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+		attribute_descriptions[2].offset = offsetof(PackedVertex, color);
+		return attribute_descriptions;
+	}
+};
+
+struct MeshLod {
+	uint32_t first_index;
+	uint32_t index_count;
+	float error; // Object space, largest distance a vertex moved from the full detail surface
+	uint32_t vertex_invocations; // Simulated post-transform cache misses for one draw of this level
+};
+
+struct MeshInstance {
+	glm::vec3 position;
+	float scale;
+};
+
+// Per draw data, read by the vertex shader from the draw buffer (indexed by firstInstance)
+struct DrawData {
+	glm::mat4 model;
+	glm::vec4 dequant_offset;
+	glm::vec4 dequant_scale;
+};
+
+// One indexed draw as submitted by the scene, this is also what frame captures store.
+// Laid out to match the std430 array in shaders/mesh.vert and shaders/cull.comp.
+struct DrawCommand {
+	DrawData data;
+	glm::vec4 bounds; // World space bounding sphere, xyz center, w radius
+	uint32_t first_index;
+	uint32_t index_count;
+	uint32_t padding[2];
+};
+
+struct Mesh {
+	std::vector<PackedVertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshLod> lods;
+
+	// LOD 0 in the order it was imported, kept around to measure what the optimizations buy
+	MeshLod unoptimized;
+
+	// Dequantization: pos = bounds_min + unorm * bounds_extent
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_extent;
+	glm::vec3 center;
+	float radius;
+};
+
+namespace mesh_tools {
+
+	constexpr uint32_t FIFO_CACHE_SIZE = 16; // Rough size of a hardware post-transform cache, used for reporting
+
+	// Number of vertex shader invocations a FIFO post-transform cache would need for the given triangles
+	inline uint32_t simulate_vertex_cache(const uint32_t* indices, size_t index_count, uint32_t vertex_count, uint32_t cache_size = FIFO_CACHE_SIZE) {
+		std::vector<uint32_t> timestamps(vertex_count, 0);
+		uint32_t time = cache_size + 1;
+		uint32_t misses = 0;
+		for (size_t i = 0; i < index_count; i++) {
+			uint32_t index = indices[i];
+			// In cache if it was inserted within the last cache_size misses
+			if (time - timestamps[index] > cache_size) {
+				timestamps[index] = time++;
+				misses++;
+			}
+		}
+		return misses;
+	}
+
+	// Tom Forsyth's linear-speed vertex cache optimisation, reorders triangles in place
+	inline void optimize_vertex_cache(uint32_t* indices, size_t index_count, uint32_t vertex_count) {
+		constexpr int CACHE_SIZE = 32;
+		constexpr float CACHE_DECAY_POWER = 1.5f;
+		constexpr float LAST_TRI_SCORE = 0.75f;
+		constexpr float VALENCE_BOOST_SCALE = 2.0f;
+		constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+		size_t triangle_count = index_count / 3;
+		if (triangle_count == 0) return;
+
+		auto vertex_score = [&](int cache_position, uint32_t remaining) -> float {
+			if (remaining == 0) return -1.0f;
+			float score = 0.0f;
+			if (cache_position >= 0) {
+				if (cache_position < 3) {
+					score = LAST_TRI_SCORE;
+				}
+				else {
+					float scaler = 1.0f / (CACHE_SIZE - 3);
+					score = std::pow(1.0f - (cache_position - 3) * scaler, CACHE_DECAY_POWER);
+				}
+			}
+			score += VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER);
+			return score;
+		};
+
+		// Vertex -> triangle adjacency
+		std::vector<uint32_t> remaining(vertex_count, 0);
+		for (size_t i = 0; i < index_count; i++) remaining[indices[i]]++;
+
+		std::vector<uint32_t> adjacency_offset(vertex_count + 1, 0);
+		for (uint32_t v = 0; v < vertex_count; v++) adjacency_offset[v + 1] = adjacency_offset[v] + remaining[v];
+		std::vector<uint32_t> adjacency(index_count);
+		std::vector<uint32_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+		for (size_t t = 0; t < triangle_count; t++) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				adjacency[fill[v]++] = (uint32_t)t;
+			}
+		}
+
+		std::vector<int> cache_position(vertex_count, -1);
+		std::vector<float> scores(vertex_count);
+		for (uint32_t v = 0; v < vertex_count; v++) scores[v] = vertex_score(-1, remaining[v]);
+
+		std::vector<float> triangle_scores(triangle_count);
+		for (size_t t = 0; t < triangle_count; t++) {
+			triangle_scores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+		}
+
+		std::vector<bool> emitted(triangle_count, false);
+		std::vector<uint32_t> output;
+		output.reserve(index_count);
+
+		std::vector<uint32_t> cache;
+		std::vector<uint32_t> new_cache;
+		cache.reserve(CACHE_SIZE + 3);
+		new_cache.reserve(CACHE_SIZE + 3);
+
+		size_t scan_cursor = 0;
+		int64_t best_triangle = -1;
+		float best_score = -1.0f;
+		for (size_t t = 0; t < triangle_count; t++) {
+			if (triangle_scores[t] > best_score) {
+				best_score = triangle_scores[t];
+				best_triangle = (int64_t)t;
+			}
+		}
+
+		while (best_triangle >= 0) {
+			size_t t = (size_t)best_triangle;
+			emitted[t] = true;
+
+			// Emit, and move the triangle's vertices to the front of the LRU cache
+			new_cache.clear();
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				new_cache.push_back(v);
+
+				// Drop the triangle from this vertex's remaining list
+				uint32_t begin = adjacency_offset[v];
+				uint32_t end = begin + remaining[v];
+				for (uint32_t a = begin; a < end; a++) {
+					if (adjacency[a] == t) {
+						std::swap(adjacency[a], adjacency[end - 1]);
+						break;
+					}
+				}
+				remaining[v]--;
+			}
+			for (uint32_t v : cache) {
+				if (v != new_cache[0] && v != new_cache[1] && v != new_cache[2]) new_cache.push_back(v);
+			}
+
+			// Rescore everything that was in the cache, including vertices that just fell out
+			for (size_t i = 0; i < new_cache.size(); i++) {
+				uint32_t v = new_cache[i];
+				cache_position[v] = i < CACHE_SIZE ? (int)i : -1;
+			}
+			for (uint32_t v : new_cache) scores[v] = vertex_score(cache_position[v], remaining[v]);
+			if (new_cache.size() > CACHE_SIZE) new_cache.resize(CACHE_SIZE);
+			cache.swap(new_cache);
+
+			// Next triangle is the best scoring one touching the cache
+			best_triangle = -1;
+			best_score = -1.0f;
+			for (uint32_t v : cache) {
+				uint32_t begin = adjacency_offset[v];
+				for (uint32_t a = begin; a < begin + remaining[v]; a++) {
+					uint32_t candidate = adjacency[a];
+					float score = scores[indices[candidate * 3]] + scores[indices[candidate * 3 + 1]] + scores[indices[candidate * 3 + 2]];
+					if (score > best_score) {
+						best_score = score;
+						best_triangle = candidate;
+					}
+				}
+			}
+
+			// Nothing adjacent left, continue from the first triangle not yet emitted
+			if (best_triangle < 0) {
+				while (scan_cursor < triangle_count && emitted[scan_cursor]) scan_cursor++;
+				if (scan_cursor < triangle_count) best_triangle = (int64_t)scan_cursor;
+			}
+		}
+
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+	// Reorders vertices by first use so fetches walk the vertex buffer linearly. Unreferenced vertices are dropped.
+	template <typename V>
+	inline void optimize_vertex_fetch(std::vector<V>& vertices, std::vector<uint32_t>& indices) {
+		std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+		std::vector<V> reordered;
+		reordered.reserve(vertices.size());
+		for (uint32_t& index : indices) {
+			if (remap[index] == UINT32_MAX) {
+				remap[index] = (uint32_t)reordered.size();
+				reordered.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices.swap(reordered);
+	}
+
+	// Vertex clustering: snap everything to a grid_resolution^3 grid over the bounds and merge each cell.
+	// Returns the largest distance a vertex moved to its cell's representative. The cell size alone
+	// underestimates it, a vertex can end up anywhere up to the cell diagonal away.
+	inline float simplify_clustered(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t grid_resolution,
+		glm::vec3 bounds_min, glm::vec3 bounds_extent, std::vector<Vertex>& out_vertices, std::vector<uint32_t>& out_indices) {
+
+		float max_extent = std::max(bounds_extent.x, std::max(bounds_extent.y, bounds_extent.z));
+		float cell_size = max_extent / grid_resolution;
+		glm::vec3 inverse_cell = glm::vec3(1.0f / cell_size);
+
+		struct Cluster {
+			glm::vec3 pos{ 0.0f };
+			glm::vec3 normal{ 0.0f };
+			glm::vec3 color{ 0.0f };
+			uint32_t count = 0;
+		};
+		std::unordered_map<uint64_t, uint32_t> cell_to_cluster;
+		std::vector<Cluster> clusters;
+		std::vector<uint32_t> vertex_cluster(vertices.size());
+
+		for (size_t i = 0; i < vertices.size(); i++) {
+			glm::vec3 cell = (vertices[i].pos - bounds_min) * inverse_cell;
+			uint64_t x = (uint64_t)std::min((float)grid_resolution - 1.0f, std::max(0.0f, std::floor(cell.x)));
+			uint64_t y = (uint64_t)std::min((float)grid_resolution - 1.0f, std::max(0.0f, std::floor(cell.y)));
+			uint64_t z = (uint64_t)std::min((float)grid_resolution - 1.0f, std::max(0.0f, std::floor(cell.z)));
+			uint64_t key = x | (y << 21) | (z << 42);
+
+			auto it = cell_to_cluster.find(key);
+			uint32_t cluster_index;
+			if (it == cell_to_cluster.end()) {
+				cluster_index = (uint32_t)clusters.size();
+				cell_to_cluster.emplace(key, cluster_index);
+				clusters.emplace_back();
+			}
+			else {
+				cluster_index = it->second;
+			}
+			Cluster& cluster = clusters[cluster_index];
+			cluster.pos += vertices[i].pos;
+			cluster.normal += vertices[i].normal;
+			cluster.color += vertices[i].color;
+			cluster.count++;
+			vertex_cluster[i] = cluster_index;
+		}
+
+		out_vertices.resize(clusters.size());
+		for (size_t i = 0; i < clusters.size(); i++) {
+			float inverse_count = 1.0f / clusters[i].count;
+			out_vertices[i].pos = clusters[i].pos * inverse_count;
+			float normal_length = glm::length(clusters[i].normal);
+			out_vertices[i].normal = normal_length > 0.0f ? clusters[i].normal / normal_length : glm::vec3(0.0f, 1.0f, 0.0f);
+			out_vertices[i].color = clusters[i].color * inverse_count;
+		}
+
+		float max_error = 0.0f;
+		for (size_t i = 0; i < vertices.size(); i++) {
+			max_error = std::max(max_error, glm::length(vertices[i].pos - out_vertices[vertex_cluster[i]].pos));
+		}
+
+		// Collapse triangles, dropping degenerates and duplicates. Rotating so the smallest index leads keeps the winding.
+		std::vector<std::array<uint32_t, 3>> triangles;
+		triangles.reserve(indices.size() / 3);
+		for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+			uint32_t a = vertex_cluster[indices[t]];
+			uint32_t b = vertex_cluster[indices[t + 1]];
+			uint32_t c = vertex_cluster[indices[t + 2]];
+			if (a == b || b == c || a == c) continue;
+
+			while (a > b || a > c) {
+				uint32_t first = a;
+				a = b; b = c; c = first;
+			}
+			triangles.push_back({ a, b, c });
+		}
+		std::sort(triangles.begin(), triangles.end());
+		triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+		out_indices.clear();
+		out_indices.reserve(triangles.size() * 3);
+		for (const auto& triangle : triangles) {
+			out_indices.insert(out_indices.end(), triangle.begin(), triangle.end());
+		}
+
+		return max_error;
+	}
+
+	inline void make_uv_sphere(uint32_t rings, uint32_t segments, glm::vec3 color, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+		const float pi = 3.14159265358979f;
+		vertices.clear();
+		indices.clear();
+		for (uint32_t r = 0; r <= rings; r++) {
+			float phi = pi * r / rings;
+			for (uint32_t s = 0; s <= segments; s++) {
+				float theta = 2.0f * pi * s / segments;
+				glm::vec3 normal(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+				// Tint by latitude so LOD transitions are visible
+				vertices.push_back({ normal, normal, color * (0.6f + 0.4f * normal.y * normal.y) });
+			}
+		}
+		// Counter-clockwise seen from outside
+		for (uint32_t r = 0; r < rings; r++) {
+			for (uint32_t s = 0; s < segments; s++) {
+				uint32_t i0 = r * (segments + 1) + s;
+				uint32_t i1 = i0 + segments + 1;
+				if (r != 0) {
+					indices.push_back(i0);
+					indices.push_back(i0 + 1);
+					indices.push_back(i1);
+				}
+				if (r != rings - 1) {
+					indices.push_back(i0 + 1);
+					indices.push_back(i1 + 1);
+					indices.push_back(i1);
+				}
+			}
+		}
+	}
+
+	inline uint16_t quantize_unorm16(float v) {
+		return (uint16_t)(std::min(1.0f, std::max(0.0f, v)) * 65535.0f + 0.5f);
+	}
+	inline int8_t quantize_snorm8(float v) {
+		return (int8_t)std::lround(std::min(1.0f, std::max(-1.0f, v)) * 127.0f);
+	}
+	inline uint8_t quantize_unorm8(float v) {
+		return (uint8_t)(std::min(1.0f, std::max(0.0f, v)) * 255.0f + 0.5f);
+	}
+
+}
+
+constexpr uint32_t MAX_MESH_LODS = 6;
+
+inline Mesh import_mesh(const std::vector<Vertex>& source_vertices, const std::vector<uint32_t>& source_indices) {
+	Mesh mesh{};
+
+	glm::vec3 bounds_min(FLT_MAX);
+	glm::vec3 bounds_max(-FLT_MAX);
+	for (const auto& vertex : source_vertices) {
+		bounds_min = glm::min(bounds_min, vertex.pos);
+		bounds_max = glm::max(bounds_max, vertex.pos);
+	}
+	mesh.bounds_min = bounds_min;
+	mesh.bounds_extent = glm::max(bounds_max - bounds_min, glm::vec3(1e-6f));
+	mesh.center = (bounds_min + bounds_max) * 0.5f;
+	mesh.radius = 0.0f;
+	for (const auto& vertex : source_vertices) {
+		mesh.radius = std::max(mesh.radius, glm::length(vertex.pos - mesh.center));
+	}
+
+	// LOD chain. Every level is clustered from the full detail mesh so errors don't accumulate.
+	std::vector<Vertex> vertices = source_vertices;
+	std::vector<uint32_t> indices = source_indices;
+	std::vector<float> errors = { 0.0f };
+	std::vector<uint32_t> lod_offsets = { 0 };
+
+	uint32_t previous_triangles = (uint32_t)source_indices.size() / 3;
+	float grid_resolution = 256.0f;
+	while (errors.size() < MAX_MESH_LODS && previous_triangles > 64 && grid_resolution >= 2.0f) {
+		std::vector<Vertex> lod_vertices;
+		std::vector<uint32_t> lod_indices;
+		float error = 0.0f;
+
+		// Shrink the grid until we are at roughly half the triangles of the previous level
+		uint32_t triangles = previous_triangles;
+		while (grid_resolution >= 2.0f) {
+			error = mesh_tools::simplify_clustered(source_vertices, source_indices, (uint32_t)grid_resolution, mesh.bounds_min, mesh.bounds_extent, lod_vertices, lod_indices);
+			triangles = (uint32_t)lod_indices.size() / 3;
+			grid_resolution *= 0.8f;
+			if (triangles <= previous_triangles / 2) break;
+		}
+		if (triangles == 0 || triangles > previous_triangles * 4 / 5) break;
+
+		uint32_t base_vertex = (uint32_t)vertices.size();
+		for (uint32_t& index : lod_indices) index += base_vertex;
+		lod_offsets.push_back((uint32_t)indices.size());
+		vertices.insert(vertices.end(), lod_vertices.begin(), lod_vertices.end());
+		indices.insert(indices.end(), lod_indices.begin(), lod_indices.end());
+		errors.push_back(error);
+		previous_triangles = triangles;
+	}
+	lod_offsets.push_back((uint32_t)indices.size());
+
+	for (size_t lod = 0; lod < errors.size(); lod++) {
+		mesh_tools::optimize_vertex_cache(indices.data() + lod_offsets[lod], lod_offsets[lod + 1] - lod_offsets[lod], (uint32_t)vertices.size());
+	}
+	mesh_tools::optimize_vertex_fetch(vertices, indices);
+
+	// Keep LOD 0 as imported at the end for comparison: its own copy of the vertices in source order,
+	// appended after the fetch remap so neither optimization touches it
+	uint32_t unoptimized_offset = (uint32_t)indices.size();
+	uint32_t unoptimized_base = (uint32_t)vertices.size();
+	vertices.insert(vertices.end(), source_vertices.begin(), source_vertices.end());
+	for (uint32_t index : source_indices) indices.push_back(unoptimized_base + index);
+
+	for (size_t lod = 0; lod < errors.size(); lod++) {
+		MeshLod mesh_lod{};
+		mesh_lod.first_index = lod_offsets[lod];
+		mesh_lod.index_count = lod_offsets[lod + 1] - lod_offsets[lod];
+		mesh_lod.error = errors[lod];
+		mesh_lod.vertex_invocations = mesh_tools::simulate_vertex_cache(indices.data() + mesh_lod.first_index, mesh_lod.index_count, (uint32_t)vertices.size());
+		mesh.lods.push_back(mesh_lod);
+	}
+	mesh.unoptimized.first_index = unoptimized_offset;
+	mesh.unoptimized.index_count = (uint32_t)source_indices.size();
+	mesh.unoptimized.error = 0.0f;
+	mesh.unoptimized.vertex_invocations = mesh_tools::simulate_vertex_cache(indices.data() + unoptimized_offset, mesh.unoptimized.index_count, (uint32_t)vertices.size());
+
+	mesh.vertices.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		glm::vec3 normalized = (vertices[i].pos - mesh.bounds_min) / mesh.bounds_extent;
+		PackedVertex& packed = mesh.vertices[i];
+		packed.pos[0] = mesh_tools::quantize_unorm16(normalized.x);
+		packed.pos[1] = mesh_tools::quantize_unorm16(normalized.y);
+		packed.pos[2] = mesh_tools::quantize_unorm16(normalized.z);
+		packed.pos[3] = 0;
+		packed.normal[0] = mesh_tools::quantize_snorm8(vertices[i].normal.x);
+		packed.normal[1] = mesh_tools::quantize_snorm8(vertices[i].normal.y);
+		packed.normal[2] = mesh_tools::quantize_snorm8(vertices[i].normal.z);
+		packed.normal[3] = 0;
+		packed.color[0] = mesh_tools::quantize_unorm8(vertices[i].color.r);
+		packed.color[1] = mesh_tools::quantize_unorm8(vertices[i].color.g);
+		packed.color[2] = mesh_tools::quantize_unorm8(vertices[i].color.b);
+		packed.color[3] = 255;
+	}
+	mesh.indices = std::move(indices);
+
+	return mesh;
+}
+
+// Coarsest LOD whose error projects to no more than threshold_pixels.
+// projection_scale is viewport_height / (2 * tan(fov_y / 2)), distance is from the camera to the instance center.
+inline uint32_t select_lod(const Mesh& mesh, float instance_scale, float distance, float projection_scale, float threshold_pixels) {
+	float surface_distance = std::max(distance - mesh.radius * instance_scale, 1e-3f);
+	uint32_t selected = 0;
+	for (uint32_t lod = 1; lod < mesh.lods.size(); lod++) {
+		float screen_error = mesh.lods[lod].error * instance_scale / surface_distance * projection_scale;
+		if (screen_error > threshold_pixels) break;
+		selected = lod;
+	}
+	return selected;
+}
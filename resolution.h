@@ -0,0 +1,112 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+/*
+	Dynamic resolution.
+
+	The scene renders into the top left sub-rect of an offscreen target that is allocated once at
+	the largest scale, so changing the scale never reallocates. shaders/upscale.frag then stretches
+	and sharpens that rect onto the swapchain image. ResolutionController picks the scale from the
+	measured GPU frame time to keep frames inside a budget.
+*/
+
+struct ResolutionSettings {
+	float min_scale = 0.5f; // Per axis, relative to the swapchain
+	float max_scale = 1.0f;
+	float gpu_budget_ms = 14.0f;
+	float sharpness = 0.5f; // 0 plain bilinear, 1 strongest
+};
+
+// std430, matches shaders/upscale.frag
+struct UpscalePushConstants {
+	glm::vec2 uv_scale; // Rendered rect / target size
+	glm::vec2 texel_size; // 1 / target size
+	float sharpness;
+};
+
+// Rounded to multiples of 8 so small scale changes don't produce odd sized rects. Native size stays exact.
+inline uint32_t scaled_dimension(uint32_t full, float scale) {
+	if (scale == 1.0f) return full;
+	uint32_t scaled = (uint32_t)std::lround(full * scale / 8.0f) * 8;
+	return std::max(scaled, 8u);
+}
+
+class ResolutionController {
+public:
+	void configure(const ResolutionSettings& resolution_settings) {
+		settings = resolution_settings;
+		scale = settings.max_scale;
+	}
+
+	// Feeds one measured GPU frame time with the scale that frame was rendered at, returns true when the scale changed.
+	// Timings lag the frames in flight: samples from before the last change are counted in the stats but not judged.
+	bool add_sample(double gpu_ms, float rendered_scale) {
+		frames++;
+		scale_total += rendered_scale;
+		min_used = std::min(min_used, rendered_scale);
+		max_used = std::max(max_used, rendered_scale);
+		if (rendered_scale != scale) return false;
+
+		// The average restarts at each scale so the old scale's timings don't leak into the decision
+		smoothed_ms = samples_at_scale == 0 ? gpu_ms : smoothed_ms + SMOOTHING * (gpu_ms - smoothed_ms);
+		if (++samples_at_scale < SETTLE_FRAMES) return false;
+
+		// Inside the deadband the scale is left alone, so it doesn't hunt around the budget
+		double ratio = settings.gpu_budget_ms / smoothed_ms;
+		if (ratio > 1.0 - DEADBAND && ratio < 1.0 + DEADBAND) return false;
+
+		// GPU time follows the pixel count, which goes with the square of the scale.
+		// Steps up are smaller than steps down: going over budget is worse than leaving a little unused.
+		float target = scale * (float)std::sqrt(ratio);
+		target = std::min(std::max(target, scale - MAX_STEP), scale + MAX_STEP * 0.5f);
+		target = std::min(std::max(target, settings.min_scale), settings.max_scale);
+		if (std::fabs(target - scale) < MIN_STEP) return false;
+
+		scale = target;
+		samples_at_scale = 0;
+		changes++;
+		return true;
+	}
+
+	// Back to full scale, e.g. when dynamic resolution is switched off
+	void reset() {
+		scale = settings.max_scale;
+		smoothed_ms = 0.0;
+		samples_at_scale = 0;
+	}
+
+	float current_scale() const { return scale; }
+	const ResolutionSettings& get_settings() const { return settings; }
+
+	void report(const char* label) const {
+		if (frames == 0) return;
+		std::cout << label << ": " << frames << " frames, avg scale " << scale_total / frames << ", min " << min_used << ", max " << max_used
+			<< ", " << changes << " changes, budget " << settings.gpu_budget_ms << " ms" << std::endl;
+	}
+
+private:
+	static constexpr double SMOOTHING = 0.1; // Exponential moving average weight of a new sample
+	static constexpr double DEADBAND = 0.05;
+	static constexpr float MAX_STEP = 0.1f;
+	static constexpr float MIN_STEP = 0.01f;
+	static constexpr int SETTLE_FRAMES = 4; // Samples at a new scale before it is judged
+
+	ResolutionSettings settings;
+	float scale = 1.0f;
+	double smoothed_ms = 0.0;
+	int samples_at_scale = 0;
+
+	uint64_t frames = 0;
+	uint64_t changes = 0;
+	double scale_total = 0.0;
+	float min_used = 1e9f;
+	float max_used = 0.0f;
+};
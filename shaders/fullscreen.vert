@@ -0,0 +1,10 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// One triangle covering the screen, drawn with 3 vertices and no vertex buffer
+layout(location = 0) out vec2 frag_uv;
+
+void main() {
+	frag_uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(frag_uv * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,107 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+struct Light {
+	vec4 position_range;
+	vec4 color_intensity;
+	vec4 direction_cos_outer;
+	vec4 params;
+};
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+	mat4 view;
+	mat4 proj;
+	mat4 view_proj;
+	mat4 inverse_proj;
+	vec4 camera_position;
+	vec4 screen_size;
+	vec4 cluster_params;
+	uvec4 cluster_grid;
+	uvec4 flags;
+} frame;
+
+layout(std430, set = 0, binding = 1) readonly buffer Lights {
+	Light lights[];
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer ClusterGrid {
+	uvec2 clusters[];
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer LightIndices {
+	uint light_indices[];
+};
+
+layout(std430, set = 0, binding = 4) buffer ClusterStats {
+	uint index_count;
+	uint overflow;
+	uint fragments_low; // 64 bit counters as two words, brute force passes 2^32 lights evaluated in one frame
+	uint fragments_high;
+	uint lights_evaluated_low;
+	uint lights_evaluated_high;
+} stats;
+
+// The stats atomics are side effects, without this they'd force depth testing after the shader runs
+layout(early_fragment_tests) in;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragWorldPosition;
+layout(location = 2) in vec3 fragNormal;
+layout(location = 3) in float fragViewDepth;
+
+layout(location = 0) out vec4 outColor;
+
+vec3 shade(Light light, vec3 position, vec3 normal, vec3 view_direction, vec3 albedo) {
+	vec3 to_light = light.position_range.xyz - position;
+	float distance_squared = dot(to_light, to_light);
+	float range = light.position_range.w;
+	if (distance_squared > range * range) return vec3(0.0);
+
+	vec3 light_direction = to_light * inversesqrt(distance_squared);
+	float falloff = 1.0 - distance_squared / (range * range);
+	float attenuation = falloff * falloff;
+
+	if (light.params.y > 0.5) {
+		float cos_angle = dot(-light_direction, light.direction_cos_outer.xyz);
+		attenuation *= smoothstep(light.direction_cos_outer.w, light.params.x, cos_angle);
+	}
+
+	float diffuse = max(dot(normal, light_direction), 0.0);
+	vec3 half_vector = normalize(light_direction + view_direction);
+	float specular = pow(max(dot(normal, half_vector), 0.0), 32.0) * 0.25;
+
+	return (albedo * diffuse + specular) * light.color_intensity.rgb * light.color_intensity.w * attenuation;
+}
+
+void main() {
+	vec3 normal = normalize(fragNormal);
+	vec3 view_direction = normalize(frame.camera_position.xyz - fragWorldPosition);
+	vec3 color = fragColor * 0.03; // Ambient
+
+	uint offset = 0;
+	uint count = frame.cluster_grid.w;
+	bool brute_force = frame.flags.y != 0;
+	if (!brute_force) {
+		uvec3 grid = frame.cluster_grid.xyz;
+		uvec2 tile = min(uvec2(gl_FragCoord.xy * frame.screen_size.zw * vec2(grid.xy)), grid.xy - 1);
+		uint slice = uint(clamp(log(fragViewDepth) * frame.cluster_params.z - frame.cluster_params.w, 0.0, float(grid.z - 1)));
+		uvec2 cluster = clusters[tile.x + tile.y * grid.x + slice * grid.x * grid.y];
+		offset = cluster.x;
+		count = cluster.y;
+	}
+
+	for (uint i = 0; i < count; i++) {
+		uint light_index = brute_force ? i : light_indices[offset + i];
+		color += shade(lights[light_index], fragWorldPosition, normal, view_direction, fragColor);
+	}
+
+	// Carry into the high word when the low one wraps, every add sees a distinct previous value
+	if (frame.flags.x != 0) {
+		uint previous = atomicAdd(stats.fragments_low, 1);
+		if (previous == 0xFFFFFFFFu) atomicAdd(stats.fragments_high, 1);
+		previous = atomicAdd(stats.lights_evaluated_low, count);
+		if (previous + count < previous) atomicAdd(stats.lights_evaluated_high, 1);
+	}
+
+	outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,52 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+	mat4 view;
+	mat4 proj;
+	mat4 view_proj;
+	mat4 inverse_proj;
+	vec4 camera_position;
+	vec4 screen_size;
+	vec4 cluster_params;
+	uvec4 cluster_grid;
+	uvec4 flags;
+} frame;
+
+struct DrawCommand {
+	mat4 model;
+	vec4 dequant_offset; // Mesh bounds min
+	vec4 dequant_scale; // Mesh bounds extent
+	vec4 bounds;
+	uint first_index;
+	uint index_count;
+	uint padding0;
+	uint padding1;
+};
+
+// Indexed by firstInstance, which the cull shader sets to the draw index
+layout(std430, set = 0, binding = 5) readonly buffer Draws {
+	DrawCommand draws[];
+};
+
+// Quantized attributes, see PackedVertex
+layout(location = 0) in vec4 inPosition; // unorm16 within the mesh bounds
+layout(location = 1) in vec4 inNormal; // snorm8
+layout(location = 2) in vec4 inColor; // unorm8
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragWorldPosition;
+layout(location = 2) out vec3 fragNormal;
+layout(location = 3) out float fragViewDepth;
+
+void main() {
+	DrawCommand draw = draws[gl_InstanceIndex];
+	vec3 position = draw.dequant_offset.xyz + inPosition.xyz * draw.dequant_scale.xyz;
+	vec4 world_position = draw.model * vec4(position, 1.0);
+	gl_Position = frame.view_proj * world_position;
+
+	fragColor = inColor.rgb;
+	fragWorldPosition = world_position.xyz;
+	fragNormal = mat3(draw.model) * inNormal.xyz; // Uniform scale only
+	fragViewDepth = -(frame.view * world_position).z;
+}
@@ -0,0 +1,40 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Stretches the rendered sub-rect of the scene target over the output and sharpens it, see resolution.h
+layout(set = 0, binding = 0) uniform sampler2D scene;
+
+layout(push_constant) uniform PushConstants {
+	vec2 uv_scale; // Rendered rect / target size
+	vec2 texel_size;
+	float sharpness;
+} pc;
+
+layout(location = 0) in vec2 frag_uv;
+
+layout(location = 0) out vec4 out_color;
+
+// Taps stay half a texel inside the rendered rect, the rest of the target holds stale pixels
+vec3 fetch(vec2 uv) {
+	vec2 lower = 0.5 * pc.texel_size;
+	vec2 upper = pc.uv_scale - 0.5 * pc.texel_size;
+	return texture(scene, clamp(uv, lower, upper)).rgb;
+}
+
+void main() {
+	vec2 uv = frag_uv * pc.uv_scale;
+
+	vec3 center = fetch(uv);
+	vec3 north = fetch(uv - vec2(0.0, pc.texel_size.y));
+	vec3 south = fetch(uv + vec2(0.0, pc.texel_size.y));
+	vec3 west = fetch(uv - vec2(pc.texel_size.x, 0.0));
+	vec3 east = fetch(uv + vec2(pc.texel_size.x, 0.0));
+
+	// Unsharp mask on the bilinear result, clamped to the neighbourhood so edges don't ring
+	vec3 blurred = (north + south + west + east) * 0.25;
+	vec3 sharpened = center + (center - blurred) * pc.sharpness * 2.0;
+	vec3 lowest = min(center, min(min(north, south), min(west, east)));
+	vec3 highest = max(center, max(max(north, south), max(west, east)));
+
+	out_color = vec4(clamp(sharpened, lowest, highest), 1.0);
+}
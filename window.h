@@ -7,16 +7,19 @@
 class Window {
 public:
 	Window() {}
-	Window(int w, int h, std::string name) : width(w), height(h), windowName(name)
+	// Headless skips GLFW entirely, window stays null
+	Window(int w, int h, std::string name, bool headless = false) : width(w), height(h), windowName(name)
 	{
-		initWindow();
+		if (!headless) initWindow();
 	}
 	~Window() {
-		glfwDestroyWindow(window);
-		glfwTerminate();
+		if (window) {
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
 	}
 	bool should_close();
-	GLFWwindow * window;
+	GLFWwindow * window = nullptr;
 
 private:
 	void initWindow();